@@ -28,6 +28,28 @@
 #include <libgen.h>          // Para dirname() y basename()
 #include <fcntl.h>           // Para open() y O_WRONLY
 #include <limits.h>          // Para PATH_MAX
+#include <sys/stat.h>        // Para fstat() y struct stat
+#include <sys/ioctl.h>       // Para ioctl(FIONREAD)
+#include <sys/mman.h>        // Para mmap()
+#include <poll.h>            // Para poll()
+#include <cstring>           // Para memcpy() y memmove()
+
+#include <unordered_map>     // Para tablas hash (std::unordered_map)
+#include <sstream>           // Para construir textos (std::ostringstream)
+#include <iomanip>           // Para formatear números (std::setprecision)
+#include <functional>        // Para callbacks (std::function)
+#include <memory>            // Para punteros inteligentes (std::unique_ptr)
+#include <map>               // Para mapas ordenados (std::map)
+#include <unordered_set>     // Para conjuntos hash (std::unordered_set)
+#include <future>            // Para tareas en segundo plano (std::async)
+#include <cmath>             // Para sqrt(), lrint() y demás funciones matemáticas
+#include <deque>             // Para colas con punteros estables (std::deque)
+#if defined(__SSE__)
+#include <xmmintrin.h>       // Para instrucciones SIMD SSE (_mm_add_ps, etc.)
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>       // Para SSE2 con doubles (_mm_add_pd, etc.)
+#endif
 
 using json = nlohmann::json;
 using namespace std;
@@ -45,6 +67,9 @@ public:
     Cancion() = default;
     Cancion(string a, string t, double dur, string d, string f)
         : artista(a), titulo(t), duracion_minutos(dur), directorio(d), archivo(f) {}
+
+    // Ruta completa del archivo de audio
+    string ruta() const { return directorio + "/" + archivo; }
 };
 
 class NodoCancion {
@@ -200,90 +225,253 @@ public:
     }
 };
 
-// --- Funciones para el cronometro ---
+// --- Utilidades de archivos ---
 
-atomic<int> tiempoActualSegundos(0);
-atomic<bool> contadorActivo(false);
-atomic<bool> contadorSalir(false);
-atomic<bool> contadorResetear(false);
-mutex mtxContador;
-condition_variable cvContador;
-
-// Variables globales para el control automático
-atomic<bool> avanzarAutomatico(false);
-
-// Variables globales adicionales
-atomic<int> saltoSegundos(10);
-
-// --- Reproducción de audio con ffplay ---
-atomic<bool> reproduciendo(false);
-atomic<bool> pausado(false);
-pid_t pid_ffplay = 0;
-
-// Variable global para detectar cuando un proceso hijo termina
-atomic<bool> procesoTerminado(false);
-
-// Función para mostrar el tiempo actual en formato 0h 0m 00s
-void mostrarTiempoActual(int segundos) {
-    int h = segundos / 3600;
-    int m = (segundos % 3600) / 60;
-    int s = segundos % 60;
-    // Sube 5 líneas (ajusta si tu interfaz cambia)
-    cout << "\033[10A\r";
-    cout << "Tiempo actual: " << h << "h " << m << "m " << s << "s      ";
-    cout << "\033[10B" << flush; // Regresa a la posición original
-}
-
-// Manejador de señal SIGCHLD mejorado
-void manejadorSIGCHLD(int sig) {
-    (void)sig; // Evitar warning de parámetro no usado
-    int status;
-    pid_t pid = waitpid(-1, &status, WNOHANG);
-    if (pid == pid_ffplay && pid > 0) {
-
-        // Debug temporal
-        // write(STDERR_FILENO, "SIGCHLD recibido\n", 17);
-
-        pid_ffplay = 0; // Resetear el PID
-        procesoTerminado = true;
-        contadorActivo = false;
-        avanzarAutomatico = true;
-        cvContador.notify_all(); // Despertar el hilo contador
-    }
-}
-
-// Hilo contador simplificado
-void hiloContador(int duracionSegundos) {
-    while (!contadorSalir) {
-        unique_lock<mutex> lk(mtxContador);
-        cvContador.wait_for(lk, chrono::seconds(1), []{ return !contadorActivo || contadorSalir || contadorResetear || procesoTerminado; });
-        
-        if (contadorSalir) break;
-        
-        if (contadorResetear) {
-            tiempoActualSegundos = 0;
-            contadorResetear = false;
-            procesoTerminado = false;
-            continue;
+// Escribe todo el buffer; false si el lector ya no existe
+bool escribirTodo(int fd, const void* datos, size_t bytes) {
+    const char* p = static_cast<const char*>(datos);
+    while (bytes > 0) {
+        ssize_t n = write(fd, p, bytes);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        bytes -= n;
+    }
+    return true;
+}
+
+// --- Historial de reproducción ---
+//
+// Registro binario de solo anexado: cada reproducción terminada o saltada es
+// un registro de tamaño fijo identificado por el ID de la pista. En memoria los
+// eventos se guardan por columnas, para recorrer millones en milisegundos, y
+// los agregados por pista se mantienen al día. La escritura a disco la hace un
+// hilo propio: el reproductor solo encola el evento.
+
+const char MAGIA_HISTORIAL[8] = {'S', 'P', 'H', 'I', 'S', 'T', '0', '1'};
+
+enum TipoEvento : uint8_t { EVENTO_COMPLETA = 0, EVENTO_SALTADA = 1 };
+
+struct RegistroEvento {
+    uint64_t pista;       // idPista() de la canción
+    int64_t instante;     // Segundos desde epoch al terminar
+    uint32_t segundos;    // Segundos escuchados
+    uint8_t tipo;         // TipoEvento
+    uint8_t reservado[3];
+};
+static_assert(sizeof(RegistroEvento) == 24, "RegistroEvento debe medir 24 bytes");
+
+struct AgregadoPista {
+    uint32_t reproducciones = 0;  // Solo las que terminaron; un salto no cuenta
+    uint32_t saltos = 0;
+    uint64_t segundosEscuchados = 0;
+    int64_t ultimaVez = 0;
+};
+
+// ID estable de una pista: FNV-1a de 64 bits sobre su ruta
+uint64_t idPista(const Cancion& c) {
+    uint64_t h = 1469598103934665603ULL;
+    for (unsigned char ch : c.ruta()) {
+        h ^= ch;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+class HistorialReproduccion {
+public:
+    explicit HistorialReproduccion(const string& ruta) : ruta(ruta) {
+        cargar();
+        escritor = thread(&HistorialReproduccion::escribir, this);
+    }
+
+    ~HistorialReproduccion() {
+        {
+            lock_guard<mutex> lk(mtxCola);
+            salir = true;
         }
-        
-        if (procesoTerminado) {
-            // El proceso terminó, el manejador ya configuró avanzarAutomatico
-            break;
+        cvCola.notify_all();
+        if (escritor.joinable()) escritor.join();
+    }
+
+    // Encola un evento; no toca el disco ni espera al escritor
+    void registrar(const Cancion& c, TipoEvento tipo, int segundos) {
+        RegistroEvento r{};
+        r.pista = idPista(c);
+        r.instante = (int64_t)time(nullptr);
+        r.segundos = segundos > 0 ? segundos : 0;
+        r.tipo = tipo;
+        {
+            lock_guard<mutex> lk(mtxCola);
+            cola.push_back(r);
         }
-        
-        if (contadorActivo) {
-            tiempoActualSegundos++;
-            mostrarTiempoActual(tiempoActualSegundos);
-            
-            // Verificar por tiempo como backup
-            if (tiempoActualSegundos >= duracionSegundos) {
-                contadorActivo = false;
-                avanzarAutomatico = true;
-                break;
+        cvCola.notify_one();
+    }
+
+    // Pistas más reproducidas (completas) en [desde, hasta), de mayor a menor
+    vector<pair<uint64_t, uint32_t>> masReproducidas(int64_t desde, int64_t hasta, size_t n) {
+        lock_guard<mutex> lk(mtxDatos);
+        // Los eventos se anexan en orden temporal: basta buscar los extremos
+        size_t ini = 0, fin = colInstante.size();
+        if (ordenado) {
+            ini = lower_bound(colInstante.begin(), colInstante.end(), desde) - colInstante.begin();
+            fin = lower_bound(colInstante.begin(), colInstante.end(), hasta) - colInstante.begin();
+        }
+        vector<uint32_t> cuentas(pistas.size(), 0);
+        for (size_t i = ini; i < fin; ++i) {
+            if (colTipo[i] == EVENTO_COMPLETA && colInstante[i] >= desde && colInstante[i] < hasta) cuentas[colIndice[i]]++;
+        }
+        vector<pair<uint64_t, uint32_t>> top;
+        for (size_t k = 0; k < cuentas.size(); ++k) {
+            if (cuentas[k]) top.push_back({pistas[k], cuentas[k]});
+        }
+        n = min(n, top.size());
+        partial_sort(top.begin(), top.begin() + n, top.end(), [](const auto& a, const auto& b) {
+            return a.second != b.second ? a.second > b.second : a.first < b.first;
+        });
+        top.resize(n);
+        return top;
+    }
+
+    // Índices de la biblioteca que nunca se han reproducido completas
+    vector<size_t> nuncaReproducidas(const vector<Cancion>& biblioteca) {
+        lock_guard<mutex> lk(mtxDatos);
+        vector<size_t> res;
+        for (size_t i = 0; i < biblioteca.size(); ++i) {
+            auto it = indices.find(idPista(biblioteca[i]));
+            if (it == indices.end() || agregados[it->second].reproducciones == 0) res.push_back(i);
+        }
+        return res;
+    }
+
+    AgregadoPista agregado(uint64_t pista) {
+        lock_guard<mutex> lk(mtxDatos);
+        auto it = indices.find(pista);
+        return it != indices.end() ? agregados[it->second] : AgregadoPista();
+    }
+
+    size_t totalEventos() {
+        lock_guard<mutex> lk(mtxDatos);
+        return colIndice.size();
+    }
+
+private:
+    string ruta;
+
+    // Eventos por columnas; cada pista distinta tiene un índice denso
+    mutex mtxDatos;
+    vector<uint32_t> colIndice;
+    vector<int64_t> colInstante;
+    vector<uint32_t> colSegundos;
+    vector<uint8_t> colTipo;
+    bool ordenado = true;
+    unordered_map<uint64_t, uint32_t> indices;  // ID de pista -> índice denso
+    vector<uint64_t> pistas;                    // Índice denso -> ID de pista
+    vector<AgregadoPista> agregados;            // Por índice denso
+
+    // Cola hacia el hilo escritor
+    mutex mtxCola;
+    condition_variable cvCola;
+    vector<RegistroEvento> cola;
+    bool salir = false;
+    thread escritor;
+
+    // Requiere mtxDatos
+    void anexar(const RegistroEvento& r) {
+        if (!colInstante.empty() && r.instante < colInstante.back()) ordenado = false;
+        auto [it, nueva] = indices.try_emplace(r.pista, (uint32_t)pistas.size());
+        if (nueva) {
+            pistas.push_back(r.pista);
+            agregados.emplace_back();
+        }
+        colIndice.push_back(it->second);
+        colInstante.push_back(r.instante);
+        colSegundos.push_back(r.segundos);
+        colTipo.push_back(r.tipo);
+        AgregadoPista& a = agregados[it->second];
+        if (r.tipo == EVENTO_COMPLETA) a.reproducciones++;
+        else a.saltos++;
+        a.segundosEscuchados += r.segundos;
+        a.ultimaVez = max(a.ultimaVez, r.instante);
+    }
+
+    void cargar() {
+        ifstream f(ruta, ios::binary);
+        if (!f.is_open()) return;
+        char magia[sizeof(MAGIA_HISTORIAL)];
+        if (!f.read(magia, sizeof(magia)) || memcmp(magia, MAGIA_HISTORIAL, sizeof(magia)) != 0) return;
+        f.seekg(0, ios::end);
+        size_t total = ((size_t)f.tellg() - sizeof(magia)) / sizeof(RegistroEvento);
+        f.seekg(sizeof(magia));
+        vector<RegistroEvento> registros(total);
+        f.read(reinterpret_cast<char*>(registros.data()), total * sizeof(RegistroEvento));
+
+        lock_guard<mutex> lk(mtxDatos);
+        colIndice.reserve(total);
+        colInstante.reserve(total);
+        colSegundos.reserve(total);
+        colTipo.reserve(total);
+        for (const RegistroEvento& r : registros) anexar(r);
+    }
+
+    void escribir() {
+        int fd = open(ruta.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (fd >= 0) {
+            struct stat st;
+            fstat(fd, &st);
+            if (st.st_size < (off_t)sizeof(MAGIA_HISTORIAL)) {
+                ftruncate(fd, 0);
+                escribirTodo(fd, MAGIA_HISTORIAL, sizeof(MAGIA_HISTORIAL));
+            } else {
+                // Descartar un registro a medias (p. ej. tras un corte de luz)
+                off_t sobra = (st.st_size - sizeof(MAGIA_HISTORIAL)) % sizeof(RegistroEvento);
+                if (sobra) ftruncate(fd, st.st_size - sobra);
+            }
+            lseek(fd, 0, SEEK_END);
+        }
+
+        vector<RegistroEvento> lote;
+        while (true) {
+            {
+                unique_lock<mutex> lk(mtxCola);
+                cvCola.wait(lk, [&]{ return salir || !cola.empty(); });
+                if (cola.empty() && salir) break;
+                lote.swap(cola);
             }
+            if (fd >= 0) escribirTodo(fd, lote.data(), lote.size() * sizeof(RegistroEvento));
+            {
+                lock_guard<mutex> lk(mtxDatos);
+                for (const RegistroEvento& r : lote) anexar(r);
+            }
+            lote.clear();
         }
+        if (fd >= 0) close(fd);
     }
+};
+
+// --- Funciones para el cronometro ---
+
+// Velocidad de reproducción (1.0 = normal); el tono se conserva
+atomic<double> velocidad(1.0);
+const double VELOCIDAD_MINIMA = 0.5;
+const double VELOCIDAD_MAXIMA = 3.0;
+const double PASO_VELOCIDAD = 0.25;
+
+// Formato 0h 0m 0s
+string formatoTiempo(int segundos) {
+    if (segundos < 0) segundos = 0;
+    return to_string(segundos / 3600) + "h " + to_string((segundos % 3600) / 60) + "m " + to_string(segundos % 60) + "s";
+}
+
+// Función para mostrar el tiempo actual y el restante, ambos en tiempo de la canción
+void mostrarTiempoActual(int segundos, int duracionSegundos) {
+    // Sube 11 líneas (ajusta si tu interfaz cambia)
+    cout << "\033[11A\r";
+    cout << "Tiempo actual: " << formatoTiempo(segundos)
+         << " | Restante: " << formatoTiempo(duracionSegundos - segundos)
+         << " | Velocidad: " << fixed << setprecision(2) << velocidad.load() << "x      ";
+    cout.unsetf(ios::fixed);
+    cout << "\033[11B" << flush; // Regresa a la posición original
 }
 
 // --- Función para obtener la ruta del ejecutable ---
@@ -309,527 +497,3800 @@ void pausa() {
     cin.ignore(numeric_limits<streamsize>::max(), '\n');
 }
 
+// Minúsculas ASCII, para buscar sin distinguir mayúsculas
+string minusculas(string texto) {
+    for (char& c : texto) c = tolower((unsigned char)c);
+    return texto;
+}
+
 // --- Cargar canciones disponibles ---
-vector<Cancion> cargarCancionesDisponibles(const string& ruta) {
-    vector<Cancion> canciones;
-    ifstream archivo(ruta);
-    if (!archivo.is_open()) {
-        cerr << "No se pudo abrir el archivo de canciones." << endl;
-        return canciones;
+//
+// canciones.json se lee en modo SAX: cada canción se entrega en cuanto se
+// termina de leer, sin construir el árbol JSON completo. Así un listado puede
+// empezar a escribir de inmediato y buscar la canción N se detiene en ella.
+
+class LectorCanciones : public nlohmann::json_sax<json> {
+public:
+    explicit LectorCanciones(function<bool(size_t, Cancion&)> alLeer) : alLeer(move(alLeer)) {}
+
+    bool null() override { return true; }
+    bool boolean(bool) override { return true; }
+    bool number_integer(number_integer_t v) override { return numero((double)v); }
+    bool number_unsigned(number_unsigned_t v) override { return numero((double)v); }
+    bool number_float(number_float_t v, const string_t&) override { return numero(v); }
+    bool binary(binary_t&) override { return true; }
+
+    bool string(string_t& v) override {
+        if (profundidad != 2) return true;
+        if (clave == "artista") actual.artista = move(v);
+        else if (clave == "titulo") actual.titulo = move(v);
+        else if (clave == "directorio") actual.directorio = move(v);
+        else if (clave == "archivo") actual.archivo = move(v);
+        return true;
     }
-    json j;
-    archivo >> j;
-    for (auto& item : j) {
-        canciones.push_back(Cancion(
-            item["artista"], 
-            item["titulo"], 
-            item["duracion_minutos"],
-            item["directorio"],
-            item["archivo"]
-        ));
+
+    bool start_object(size_t) override {
+        if (++profundidad == 2) actual = Cancion("", "", 0, "", "");
+        return true;
     }
-    return canciones;
-}
 
-// Función para reproducir desde una posición específica usando ffplay
-void reproducirDesdeSegundo(const Cancion& cancion, int segundoInicio = 0) {
-    string ruta = cancion.directorio + "/" + cancion.archivo;
-    
-    // Detener reproducción anterior si existe
-    if (pid_ffplay > 0) {
-        kill(pid_ffplay, SIGTERM);
-        waitpid(pid_ffplay, nullptr, 0);
-        pid_ffplay = 0;
+    bool key(string_t& k) override {
+        if (profundidad == 2) clave = k;
+        return true;
     }
-    
-    pid_ffplay = fork();
-    if (pid_ffplay == 0) {
-        // Redirigir stdout y stderr a /dev/null
-        int devnull = open("/dev/null", O_WRONLY);
-        dup2(devnull, STDOUT_FILENO);
-        dup2(devnull, STDERR_FILENO);
-        close(devnull);
-        
-        if (segundoInicio > 0) {
-            // Usar ffplay con opción -ss para saltar tiempo
-            string salto = to_string(segundoInicio);
-            execlp("ffplay", "ffplay", "-nodisp", "-autoexit", "-ss", salto.c_str(), ruta.c_str(), nullptr);
-        } else {
-            // Reproducción normal desde el inicio
-            execlp("ffplay", "ffplay", "-nodisp", "-autoexit", ruta.c_str(), nullptr);
+
+    bool end_object() override {
+        if (--profundidad == 1 && !alLeer(indice++, actual)) {
+            detenido = true;
+            return false;
         }
-        exit(1);
+        return true;
     }
-    
-    // Asegurar que las variables de estado estén correctas
-    reproduciendo = true;
-    pausado = false;
-}
 
-// Función para reproducir una canción (wrapper)
-void reproducirCancion(const Cancion& cancion) {
-    reproducirDesdeSegundo(cancion, 0);
-}
+    bool start_array(size_t) override { ++profundidad; return true; }
+    bool end_array() override { --profundidad; return true; }
 
-void detenerCancion() {
-    if (pid_ffplay > 0) {
-        kill(pid_ffplay, SIGTERM);
-        waitpid(pid_ffplay, nullptr, 0);
-        pid_ffplay = 0;
+    bool parse_error(size_t, const string_t&, const nlohmann::detail::exception& e) override {
+        error = e.what();
+        return false;
     }
-    reproduciendo = false;
-    pausado = false;
-}
 
-void pausarCancion() {
-    if (pid_ffplay > 0 && reproduciendo) {
-        kill(pid_ffplay, SIGSTOP); // Pausar el proceso
+    bool detenido = false;
+    string_t error;
+
+private:
+    function<bool(size_t, Cancion&)> alLeer;
+    Cancion actual;
+    string_t clave;
+    int profundidad = 0;
+    size_t indice = 0;
+
+    bool numero(double v) {
+        if (profundidad == 2 && clave == "duracion_minutos") actual.duracion_minutos = v;
+        return true;
     }
-}
+};
 
-void reanudarCancion() {
-    if (pid_ffplay > 0 && reproduciendo) {
-        kill(pid_ffplay, SIGCONT); // Reanudar el proceso
+// Recorre las canciones en orden; el callback devuelve false para detenerse.
+// El archivo se proyecta en memoria: solo se leen las páginas que se recorren.
+bool recorrerCanciones(const string& ruta, function<bool(size_t, Cancion&)> alLeer) {
+    int fd = open(ruta.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        bool vacio = st.st_size == 0;
+        close(fd);
+        return vacio;
     }
+    void* mapa = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapa == MAP_FAILED) return false;
+    madvise(mapa, st.st_size, MADV_SEQUENTIAL);
+
+    LectorCanciones lector(move(alLeer));
+    const char* inicio = static_cast<const char*>(mapa);
+    json::sax_parse(inicio, inicio + st.st_size, &lector);
+    munmap(mapa, st.st_size);
+    if (!lector.error.empty()) cerr << "Error en " << ruta << ": " << lector.error << endl;
+    return true;
 }
 
-// Función mejorada para avanzar rápido with ffplay
-void avanzarRapido(const Cancion& cancion, int duracionSegundos, thread& thContador) {
-    if (reproduciendo) {
-        int nuevoTiempo = tiempoActualSegundos + saltoSegundos;
-        if (nuevoTiempo >= duracionSegundos) {
-            // Si excede la duración, activar avance automático
-            avanzarAutomatico = true;
-        } else {
-            // Finalizar hilo contador anterior
-            contadorSalir = true;
-            contadorActivo = false;
-            cvContador.notify_all();
-            if (thContador.joinable()) thContador.join();
-            
-            // Actualizar tiempo ANTES de reproducir
-            tiempoActualSegundos = nuevoTiempo;
-            
-            // Reproducir desde nueva posición
-            reproducirDesdeSegundo(cancion, nuevoTiempo);
-            
-            // Reiniciar hilo contador
-            contadorSalir = false;
-            contadorResetear = false;
-            contadorActivo = true;
-            thContador = thread(hiloContador, duracionSegundos);
-        }
-    }
-}
-
-// Función mejorada para retroceder con ffplay
-void retroceder(const Cancion& cancion, int duracionSegundos, thread& thContador) {
-    if (reproduciendo) {
-        int nuevoTiempo = tiempoActualSegundos - saltoSegundos;
-        if (nuevoTiempo < 0) nuevoTiempo = 0;
-        
-        // Finalizar hilo contador anterior
-        contadorSalir = true;
-        contadorActivo = false;
-        cvContador.notify_all();
-        if (thContador.joinable()) thContador.join();
-        
-        // Actualizar tiempo ANTES de reproducir
-        tiempoActualSegundos = nuevoTiempo;
-        
-        // Reproducir desde nueva posición
-        reproducirDesdeSegundo(cancion, nuevoTiempo);
-        
-        // Reiniciar hilo contador
-        contadorSalir = false;
-        contadorResetear = false;
-        contadorActivo = true;
-        thContador = thread(hiloContador, duracionSegundos);
+vector<Cancion> cargarCancionesDisponibles(const string& ruta) {
+    vector<Cancion> canciones;
+    bool abierto = recorrerCanciones(ruta, [&](size_t, Cancion& c) {
+        canciones.push_back(move(c));
+        return true;
+    });
+    if (!abierto) {
+        cerr << "No se pudo abrir el archivo de canciones." << endl;
     }
+    return canciones;
 }
 
-// --- Modo reproductor interactivo ---
+// --- Presets del ecualizador ---
+//
+// Bandas y presets con nombre; la sesión los carga junto con la playlist. El
+// filtrado en sí está en la sección del ecualizador paramétrico.
 
-void mostrarVistaReproductor(Playlist& pl, bool shuffle, int idx, NodoCancion* nodo) {
-    limpiarPantalla();
-    cout << "=== SIMPLE PLAYER ===" << endl;
-    cout << "Tu playlist actual contiene " << pl.contar() << " canciones," << endl;
-    cout << "con un total de " << (int)pl.duracionTotal() << " minutos de música." << endl;
-    cout << "------------------------------------------" << endl;
-    cout << "Canción actual: " << idx << endl;
-    cout << "Título: " << nodo->cancion.titulo << endl;
-    cout << "Artista: " << nodo->cancion.artista << endl;
-    int min = (int)nodo->cancion.duracion_minutos;
-    int seg = (int)((nodo->cancion.duracion_minutos - min) * 60);
-    cout << "Duración: 0h " << min << "m " << seg << "s" << endl;
-    // Línea de tiempo actual
-    cout << "Tiempo actual: 0h 0m 0s" << endl;
-    cout << "------------------------------------------" << endl;
-    cout << "Presiona un comando en cualquier momento:" << endl;
-    cout << endl;
-    cout << "[R] = Reproducir    | [P] = Pausar" << endl;
-    cout << "[S] = Siguiente     | [A] = Anterior" << endl;
-    cout << "[F] = Avance rápido | [B] = Retroceso" << endl;
-    cout << "[M] = Modo aleatorio [" << (shuffle ? "On" : "Off") << "]" << endl;
-    cout << "[Q] = Detener" << endl;
-    cout << "------------------------------------------" << endl;
-}
+const int MAX_BANDAS = 10;
 
-void modoReproductor(Playlist& pl) {
-    if (pl.contar() == 0) {
-        cout << "Tu playlist está vacía." << endl;
-        pausa();
-        return;
+enum TipoFiltro { FILTRO_PICO, FILTRO_GRAVES, FILTRO_AGUDOS, FILTRO_PASO_BAJO, FILTRO_PASO_ALTO, NUM_FILTROS };
+const char* NOMBRES_FILTRO[NUM_FILTROS] = {"pico", "graves", "agudos", "paso_bajo", "paso_alto"};
+
+struct BandaEcualizador {
+    TipoFiltro tipo = FILTRO_PICO;
+    double frecuencia = 1000;   // Hz
+    double gananciaDb = 0;      // Solo pico y estantes (graves/agudos)
+    double q = 0.707;
+};
+
+// Presets con nombre, guardados junto a la playlist (playlist.json -> playlist.eq.json)
+class PresetsEcualizador {
+public:
+    map<string, vector<BandaEcualizador>> presets;
+    string activo; // Vacío = plano
+
+    static string rutaPara(const string& rutaPlaylist) {
+        string base = rutaPlaylist;
+        if (base.size() >= 5 && base.compare(base.size() - 5, 5, ".json") == 0) base.resize(base.size() - 5);
+        return base + ".eq.json";
     }
-    bool shuffle = false;
-    vector<NodoCancion*> orden;
-    int idx = pl.indiceActual();
-    NodoCancion* nodo = pl.actual ? pl.actual : pl.cabeza;
-    int idxShuffle = 0;
-    string ultimaCancion = nodo->cancion.archivo;
 
-    auto recalcularShuffle = [&]() {
-        orden = pl.nodosVector();
-        random_device rd;
-        mt19937 g(rd());
-        std::shuffle(orden.begin(), orden.end(), g);
-        idxShuffle = 0;
-        for (size_t i = 0; i < orden.size(); ++i) {
-            if (orden[i]->cancion.archivo == ultimaCancion) {
-                idxShuffle = i;
-                break;
+    void cargar(const string& ruta) {
+        presets.clear();
+        activo.clear();
+        ifstream f(ruta);
+        if (!f.is_open()) return;
+        json j = json::parse(f, nullptr, false);
+        if (j.is_discarded() || !j.is_object()) return;
+        // Un archivo editado a mano no debe tumbar el programa: los campos con
+        // tipo incorrecto toman su valor por omisión y lo que no es una banda se omite
+        activo = texto(j, "activo", "");
+        if (!j.contains("presets") || !j["presets"].is_object()) return;
+        for (auto& [nombre, lista] : j["presets"].items()) {
+            if (!lista.is_array()) continue;
+            vector<BandaEcualizador> bandas;
+            for (auto& item : lista) {
+                if (!item.is_object()) continue;
+                BandaEcualizador b;
+                string tipo = texto(item, "tipo", "pico");
+                for (int t = 0; t < NUM_FILTROS; ++t) {
+                    if (tipo == NOMBRES_FILTRO[t]) b.tipo = (TipoFiltro)t;
+                }
+                b.frecuencia = numero(item, "frecuencia", 1000.0);
+                b.gananciaDb = numero(item, "ganancia_db", 0.0);
+                b.q = numero(item, "q", 0.707);
+                if (b.frecuencia <= 0) b.frecuencia = 1000.0;
+                if (b.q <= 0) b.q = 0.707;
+                bandas.push_back(b);
             }
+            presets[nombre] = bandas;
         }
-    };
+    }
 
-    if (shuffle) recalcularShuffle();
+    void guardar(const string& ruta) {
+        json j;
+        j["activo"] = activo;
+        j["presets"] = json::object();
+        for (auto& [nombre, bandas] : presets) {
+            json lista = json::array();
+            for (const BandaEcualizador& b : bandas) {
+                lista.push_back({
+                    {"tipo", NOMBRES_FILTRO[b.tipo]},
+                    {"frecuencia", b.frecuencia},
+                    {"ganancia_db", b.gananciaDb},
+                    {"q", b.q}
+                });
+            }
+            j["presets"][nombre] = lista;
+        }
+        ofstream f(ruta);
+        f << j.dump(4);
+    }
 
-    bool salir = false;
+    vector<BandaEcualizador> bandasActivas() const {
+        auto it = presets.find(activo);
+        return it != presets.end() ? it->second : vector<BandaEcualizador>();
+    }
 
-    // --- INICIO: Reproducir automáticamente al entrar ---
-    reproduciendo = true;
-    pausado = false;
-    int duracionSegundos = (int)(nodo->cancion.duracion_minutos * 60);
-    contadorSalir = false;
-    contadorResetear = false;
-    contadorActivo = true;
-    avanzarAutomatico = false;
-    procesoTerminado = false;
-    thread thContador(hiloContador, duracionSegundos);
-    reproducirCancion(nodo->cancion);
-    // --- FIN ---
+private:
+    static string texto(const json& obj, const char* clave, const string& omision) {
+        auto it = obj.find(clave);
+        return it != obj.end() && it->is_string() ? it->get<string>() : omision;
+    }
 
-    while (!salir) {
-        // Verificar si necesita avanzar automáticamente
-        if (avanzarAutomatico) {
-            avanzarAutomatico = false;
-            
-            // Debug temporal
-            // cout << "\rAvance automático activado..." << flush;
-            // this_thread::sleep_for(chrono::milliseconds(500));
-            
-            // Finalizar hilo contador anterior si aún está corriendo
-            contadorSalir = true;
-            contadorActivo = false;
-            cvContador.notify_all();
-            if (thContador.joinable()) thContador.join();
-            
-            if (!shuffle) {
-                if (nodo->siguiente) {
-                    pl.actual = nodo->siguiente;
-                    ultimaCancion = pl.actual->cancion.archivo;
-                    nodo = pl.actual;
-                    duracionSegundos = (int)(nodo->cancion.duracion_minutos * 60);
-                    
-                    // Reiniciar reproducción
-                    reproduciendo = true;
-                    pausado = false;
-                    tiempoActualSegundos = 0;
-                    contadorSalir = false;
-                    contadorResetear = false;
-                    contadorActivo = true;
-                    procesoTerminado = false;
-                    
-                    thContador = thread(hiloContador, duracionSegundos);
-                    reproducirCancion(pl.actual->cancion);
-                } else {
-                    // Fin de la playlist
-                    reproduciendo = false;
-                    contadorActivo = false;
-                    cout << "\rFin de la playlist." << endl;
-                    pausa();
-                }
-            } else {
-                if (idxShuffle + 1 < (int)orden.size()) {
-                    idxShuffle++;
-                    ultimaCancion = orden[idxShuffle]->cancion.archivo;
-                    nodo = orden[idxShuffle];
-                    duracionSegundos = (int)(nodo->cancion.duracion_minutos * 60);
-                    
-                    // Reiniciar reproducción
-                    reproduciendo = true;
-                    pausado = false;
-                    tiempoActualSegundos = 0;
-                    contadorSalir = false;
-                    contadorResetear = false;
-                    contadorActivo = true;
-                    procesoTerminado = false;
-                    
-                    thContador = thread(hiloContador, duracionSegundos);
-                    reproducirCancion(orden[idxShuffle]->cancion);
-                } else {
-                    // Fin de la playlist aleatoria
-                    reproduciendo = false;
-                    contadorActivo = false;
-                    cout << "\rFin de la playlist aleatoria." << endl;
-                    pausa();
-                }
-            }
-            
-            // Continuar el bucle para actualizar la interfaz
-            continue;
-        }
+    static double numero(const json& obj, const char* clave, double omision) {
+        auto it = obj.find(clave);
+        return it != obj.end() && it->is_number() ? it->get<double>() : omision;
+    }
+};
 
-        if (!shuffle) {
-            idx = pl.indiceActual();
-            nodo = pl.nodoEn(idx);
-        } else {
-            if (orden.empty()) recalcularShuffle();
-            nodo = orden[idxShuffle];
-            idx = idxShuffle + 1;
+// --- Sesión: datos cargados solo cuando una orden los necesita ---
+
+class Sesion {
+public:
+    string rutaCanciones;
+    string rutaPlaylist;
+    string rutaHistorial;
+
+    Sesion(string canciones, string playlist, string historial)
+        : rutaCanciones(canciones), rutaPlaylist(playlist), rutaHistorial(historial) {}
+
+    vector<Cancion>& biblioteca() {
+        if (!bibliotecaCargada) {
+            canciones = cargarCancionesDisponibles(rutaCanciones);
+            bibliotecaCargada = true;
         }
-        mostrarVistaReproductor(pl, shuffle, idx, nodo);
-        mostrarTiempoActual(tiempoActualSegundos);
+        return canciones;
+    }
 
-        // Usar un timeout más corto para detectar cambios más rápido
-        struct termios oldt, newt;
-        tcgetattr(STDIN_FILENO, &oldt);
-        newt = oldt;
-        newt.c_lflag &= ~(ICANON | ECHO);
-        tcsetattr(STDIN_FILENO, TCSANOW, &newt);
-        
-        // Configurar timeout para detectar avance automático más rápido
-        fd_set fds;
-        FD_ZERO(&fds);
-        FD_SET(STDIN_FILENO, &fds);
-        struct timeval timeout;
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 500000; // 500ms
-        
-        char tecla = 0;
-        int result = select(STDIN_FILENO + 1, &fds, NULL, NULL, &timeout);
-        if (result > 0 && FD_ISSET(STDIN_FILENO, &fds)) {
-            tecla = getchar();
+    // Canción N (1-based) de la biblioteca. Para una sola búsqueda se lee solo
+    // hasta ella; en lote se carga la biblioteca una vez para todas
+    bool cancionEn(size_t n, Cancion& c) {
+        if (n < 1) return false;
+        if (bibliotecaCargada || enLote) {
+            biblioteca();
+            if (n > canciones.size()) return false;
+            c = canciones[n - 1];
+            return true;
         }
-        
-        tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
-        
-        // Si no hay tecla pero hay avance automático, continuar el bucle
-        if (result == 0 || tecla == 0) {
-            if (avanzarAutomatico) continue;
-            else continue; // Continuar el bucle para verificar estado
+        bool encontrada = false;
+        recorrerCanciones(rutaCanciones, [&](size_t i, Cancion& actual) {
+            if (i + 1 < n) return true;
+            c = move(actual);
+            encontrada = true;
+            return false;
+        });
+        return encontrada;
+    }
+
+    Playlist& playlist() {
+        if (!playlistCargada) {
+            miPlaylist.cargar(rutaPlaylist);
+            playlistCargada = true;
         }
+        return miPlaylist;
+    }
 
-        switch (tecla) {
-            case 'r':
-            case 'R':
-                if (reproduciendo) detenerCancion();
-                
-                // Finalizar hilo contador anterior
-                contadorSalir = true;
-                contadorActivo = false;
-                cvContador.notify_all();
-                if (thContador.joinable()) thContador.join();
-                
-                reproduciendo = true;
-                pausado = false;
-                contadorResetear = true;
-                contadorActivo = true;
-                avanzarAutomatico = false;
-                procesoTerminado = false;
-                duracionSegundos = (int)(nodo->cancion.duracion_minutos * 60);
-                
-                contadorSalir = false;
-                thContador = thread(hiloContador, duracionSegundos);
-                reproducirCancion(nodo->cancion);
-                break;
-            case 'p':
-            case 'P':
-                if (reproduciendo && !pausado) {
-                    pausarCancion();
-                    pausado = true;
-                    contadorActivo = false;
-                } else if (reproduciendo && pausado) {
-                    reanudarCancion();
-                    pausado = false;
-                    contadorActivo = true;
-                    cvContador.notify_all();
-                }
-                break;
-            case 's':
-            case 'S':
-                if (reproduciendo) detenerCancion();
-                
-                // Finalizar hilo contador anterior
-                contadorSalir = true;
-                contadorActivo = false;
-                cvContador.notify_all();
-                if (thContador.joinable()) thContador.join();
-                
-                if (!shuffle) {
-                    if (nodo->siguiente) {
-                        pl.actual = nodo->siguiente;
-                        ultimaCancion = pl.actual->cancion.archivo;
-                        reproduciendo = true;
-                        pausado = false;
-                        contadorResetear = true;
-                        contadorActivo = true;
-                        avanzarAutomatico = false;
-                        nodo = pl.actual;
-                        duracionSegundos = (int)(nodo->cancion.duracion_minutos * 60);
-                        
-                        contadorSalir = false;
-                        thContador = thread(hiloContador, duracionSegundos);
-                        reproducirCancion(pl.actual->cancion);
-                    } else {
-                        cout << "\rFin de la lista." << endl;
-                        pausa();
-                    }
-                } else {
-                    if (idxShuffle + 1 < (int)orden.size()) {
-                        idxShuffle++;
-                        ultimaCancion = orden[idxShuffle]->cancion.archivo;
-                        reproduciendo = true;
-                        pausado = false;
-                        contadorResetear = true;
-                        contadorActivo = true;
-                        avanzarAutomatico = false;
-                        nodo = orden[idxShuffle];
-                        duracionSegundos = (int)(nodo->cancion.duracion_minutos * 60);
-                        
-                        contadorSalir = false;
-                        thContador = thread(hiloContador, duracionSegundos);
-                        reproducirCancion(orden[idxShuffle]->cancion);
-                    } else {
-                        cout << "\rFin de la lista aleatoria." << endl;
-                        pausa();
-                    }
-                }
-                break;
-            case 'a':
-            case 'A':
-                if (reproduciendo) detenerCancion();
-                
-                // Finalizar hilo contador anterior
-                contadorSalir = true;
-                contadorActivo = false;
-                cvContador.notify_all();
-                if (thContador.joinable()) thContador.join();
-                
-                if (!shuffle) {
-                    if (nodo->anterior) {
-                        pl.actual = nodo->anterior;
-                        ultimaCancion = pl.actual->cancion.archivo;
-                        reproduciendo = true;
-                        pausado = false;
-                        contadorResetear = true;
-                        contadorActivo = true;
-                        avanzarAutomatico = false;
-                        nodo = pl.actual;
-                        duracionSegundos = (int)(nodo->cancion.duracion_minutos * 60);
-                        
-                        contadorSalir = false;
-                        thContador = thread(hiloContador, duracionSegundos);
-                        reproducirCancion(pl.actual->cancion);
-                    } else {
-                        cout << "\rInicio de la lista." << endl;
-                        pausa();
-                    }
-                } else {
-                    if (idxShuffle > 0) {
-                        idxShuffle--;
-                        ultimaCancion = orden[idxShuffle]->cancion.archivo;
-                        reproduciendo = true;
-                        pausado = false;
-                        contadorResetear = true;
-                        contadorActivo = true;
-                        avanzarAutomatico = false;
-                        nodo = orden[idxShuffle];
-                        duracionSegundos = (int)(nodo->cancion.duracion_minutos * 60);
-                        
-                        contadorSalir = false;
-                        thContador = thread(hiloContador, duracionSegundos);
-                        reproducirCancion(orden[idxShuffle]->cancion);
-                    } else {
-                        cout << "\rInicio de la lista aleatoria." << endl;
-                        pausa();
-                    }
-                }
-                break;
-            case 'f':
-            case 'F':
-                avanzarRapido(nodo->cancion, duracionSegundos, thContador);
-                break;
-            case 'b':
-            case 'B':
-                retroceder(nodo->cancion, duracionSegundos, thContador);
-                break;
-            case 'm':
-            case 'M':
-                shuffle = !shuffle;
-                if (shuffle) {
-                    recalcularShuffle();
-                } else {
-                    NodoCancion* buscar = pl.cabeza;
-                    while (buscar && buscar->cancion.archivo != ultimaCancion) buscar = buscar->siguiente;
-                    if (buscar) pl.actual = buscar;
-                }
-                break;
-            case 'q':
-            case 'Q':
-                if (reproduciendo) detenerCancion();
-                contadorSalir = true;
-                contadorActivo = false;
-                cvContador.notify_all();
-                salir = true;
-                break;
-            default:
-                break;
+    // Cambia de playlist, guardando antes la actual si tenía cambios
+    void usarPlaylist(const string& ruta) {
+        if (ruta == rutaPlaylist) return;
+        if (modificada) guardarPlaylist();
+        rutaPlaylist = ruta;
+        playlistCargada = false;
+        presetsCargados = false;
+    }
+
+    // Presets de ecualizador de la playlist actual
+    PresetsEcualizador& presets() {
+        if (!presetsCargados) {
+            misPresets.cargar(PresetsEcualizador::rutaPara(rutaPlaylist));
+            presetsCargados = true;
         }
+        return misPresets;
     }
-    // Finalizar hilo contador
-    contadorSalir = true;
-    contadorActivo = false;
-    cvContador.notify_all();
-    if (thContador.joinable()) thContador.join();
-}
 
-// --- Menú principal ---
+    void guardarPresets() {
+        presets().guardar(PresetsEcualizador::rutaPara(rutaPlaylist));
+    }
 
-void menuPrincipal() {
-    cout << "=== SIMPLE PLAYER ===" << endl;
-    cout << "1. Mostrar canciones disponibles" << endl;
-    cout << "2. Agregar canción a mi playlist" << endl;
-    cout << "3. Mostrar playlist completa" << endl;
-    cout << "4. Mostrar duración total de la lista" << endl;
-    cout << "5. Reproducir playlist" << endl;
-    cout << "6. Guardar mi lista" << endl;
-    cout << "7. Eliminar canción de mi playlist" << endl;
-    cout << "8. Salir" << endl;
+    void guardarPlaylist() {
+        playlist().guardar(rutaPlaylist);
+        modificada = false;
+    }
+
+    // Guarda solo si la playlist llegó a cargarse (si no, el archivo no cambió)
+    void guardarSiCargada() {
+        if (playlistCargada) guardarPlaylist();
+    }
+
+    HistorialReproduccion& historial() {
+        if (!miHistorial) miHistorial.reset(new HistorialReproduccion(rutaHistorial));
+        return *miHistorial;
+    }
+
+    bool modificada = false;
+    bool enLote = false;  // Se esperan muchas búsquedas (modo batch)
+
+private:
+    vector<Cancion> canciones;
+    bool bibliotecaCargada = false;
+    Playlist miPlaylist;
+    bool playlistCargada = false;
+    PresetsEcualizador misPresets;
+    bool presetsCargados = false;
+    unique_ptr<HistorialReproduccion> miHistorial;
+};
+
+// --- Formato del audio decodificado ---
+
+const int FRECUENCIA_MUESTREO = 44100;
+const int CANALES = 2;                   // PCM intercalado: L R L R ...
+const size_t FRAMES_BLOQUE = 4096;       // Frames procesados por iteración
+
+// --- Cambio de velocidad sin alterar el tono (WSOLA) ---
+//
+// El audio se corta en secuencias de 40 ms que se vuelven a pegar con un
+// fundido de 8 ms. Entre secuencia y secuencia la entrada avanza 'tempo'
+// veces lo que avanza la salida, y el punto exacto de corte se busca en una
+// ventana de 15 ms: el que mejor se correlaciona con el final de lo ya emitido.
+// La correlación y el fundido, que son casi todo el costo, usan SSE.
+
+inline void correlacionYEnergia(const float* a, const float* ref, int n, float& corr, float& energia) {
+    int i = 0;
+    float c = 0, e = 0;
+#if defined(__SSE__)
+    __m128 vc = _mm_setzero_ps(), ve = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        __m128 va = _mm_loadu_ps(a + i);
+        vc = _mm_add_ps(vc, _mm_mul_ps(va, _mm_loadu_ps(ref + i)));
+        ve = _mm_add_ps(ve, _mm_mul_ps(va, va));
+    }
+    float tc[4], te[4];
+    _mm_storeu_ps(tc, vc);
+    _mm_storeu_ps(te, ve);
+    c = tc[0] + tc[1] + tc[2] + tc[3];
+    e = te[0] + te[1] + te[2] + te[3];
+#endif
+    for (; i < n; ++i) {
+        c += a[i] * ref[i];
+        e += a[i] * a[i];
+    }
+    corr = c;
+    energia = e;
+}
+
+// salida = saliente + (entrante - saliente) * rampa
+inline void fundir(const float* saliente, const float* entrante, const float* rampa, float* salida, int n) {
+    int i = 0;
+#if defined(__SSE__)
+    for (; i + 4 <= n; i += 4) {
+        __m128 vs = _mm_loadu_ps(saliente + i);
+        __m128 ve = _mm_loadu_ps(entrante + i);
+        _mm_storeu_ps(salida + i, _mm_add_ps(vs, _mm_mul_ps(_mm_sub_ps(ve, vs), _mm_loadu_ps(rampa + i))));
+    }
+#endif
+    for (; i < n; ++i) salida[i] = saliente[i] + (entrante[i] - saliente[i]) * rampa[i];
+}
+
+class EstiradorTiempo {
+public:
+    static const int SECUENCIA = FRECUENCIA_MUESTREO * 40 / 1000;
+    static const int SOLAPE = FRECUENCIA_MUESTREO * 8 / 1000;
+    static const int BUSQUEDA = FRECUENCIA_MUESTREO * 15 / 1000;
+
+    EstiradorTiempo() : rampa(SOLAPE * CANALES) {
+        for (int i = 0; i < SOLAPE; ++i) {
+            for (int c = 0; c < CANALES; ++c) rampa[i * CANALES + c] = (float)i / SOLAPE;
+        }
+        entrada.reserve((SECUENCIA + BUSQUEDA + FRAMES_BLOQUE) * CANALES);
+        final.reserve(SOLAPE * CANALES);
+    }
+
+    // Frames de entrada recibidos que la salida todavía no cubre (negativo si
+    // falta descartar parte de la entrada que viene)
+    int64_t retraso() const { return (int64_t)framesEntrada() - (int64_t)porSaltar; }
+
+    // Olvida todo lo pendiente
+    void reiniciar() {
+        entrada.clear();
+        final.clear();
+        acumulado = 0;
+        porSaltar = 0;
+    }
+
+    // Para volver a velocidad normal sin saltos: anexa a 'salida' lo pendiente
+    // junto con 'frames' frames nuevos, sin estirar. El final de la última
+    // secuencia se funde con la entrada y el resto pasa tal cual. Queda reiniciado
+    void vaciar(const float* datos, size_t frames, vector<float>& salida) {
+        size_t descartar = min(porSaltar, frames);
+        entrada.insert(entrada.end(), datos + descartar * CANALES, datos + frames * CANALES);
+
+        size_t d = (!final.empty() && framesEntrada() >= (size_t)(BUSQUEDA + SOLAPE)) ? mejorDesplazamiento() : 0;
+        const float* seq = entrada.data() + d * CANALES;
+        size_t disponibles = framesEntrada() - d;
+        size_t fundidos = final.empty() ? 0 : min(disponibles, (size_t)SOLAPE);
+        size_t base = salida.size();
+        salida.resize(base + disponibles * CANALES);
+        float* out = salida.data() + base;
+        fundir(final.data(), seq, rampa.data(), out, fundidos * CANALES);
+        memcpy(out + fundidos * CANALES, seq + fundidos * CANALES, (disponibles - fundidos) * CANALES * sizeof(float));
+        reiniciar();
+    }
+
+    // Recibe 'frames' frames intercalados y anexa a 'salida' los ya estirados
+    void procesar(const float* datos, size_t frames, double tempo, vector<float>& salida) {
+        // Si el salto anterior fue más largo que la entrada que había, descartar lo que falte
+        size_t descartar = min(porSaltar, frames);
+        porSaltar -= descartar;
+        entrada.insert(entrada.end(), datos + descartar * CANALES, datos + frames * CANALES);
+
+        while (framesEntrada() >= (size_t)(SECUENCIA + BUSQUEDA)) {
+            int d = final.empty() ? 0 : mejorDesplazamiento();
+            const float* seq = entrada.data() + d * CANALES;
+            size_t base = salida.size();
+            salida.resize(base + (SECUENCIA - SOLAPE) * CANALES);
+            float* out = salida.data() + base;
+
+            // Fundido con el final de la secuencia anterior y luego el cuerpo tal cual
+            if (final.empty()) memcpy(out, seq, SOLAPE * CANALES * sizeof(float));
+            else fundir(final.data(), seq, rampa.data(), out, SOLAPE * CANALES);
+            memcpy(out + SOLAPE * CANALES, seq + SOLAPE * CANALES, (SECUENCIA - 2 * SOLAPE) * CANALES * sizeof(float));
+            final.assign(seq + (SECUENCIA - SOLAPE) * CANALES, seq + SECUENCIA * CANALES);
+
+            // La entrada avanza 'tempo' veces lo emitido
+            acumulado += tempo * (SECUENCIA - SOLAPE);
+            size_t avance = (size_t)acumulado;
+            acumulado -= avance;
+            size_t ahora = min(avance, framesEntrada());
+            entrada.erase(entrada.begin(), entrada.begin() + ahora * CANALES);
+            porSaltar += avance - ahora;
+        }
+    }
+
+private:
+    vector<float> entrada;  // Frames recibidos y aún no consumidos
+    vector<float> final;    // Últimos SOLAPE frames de la secuencia anterior
+    vector<float> rampa;    // Pesos del fundido, por muestra intercalada
+    double acumulado = 0;   // Parte fraccionaria del avance
+    size_t porSaltar = 0;   // Frames del avance que aún no habían llegado
+
+    size_t framesEntrada() const { return entrada.size() / CANALES; }
+
+    // Desplazamiento en [0, BUSQUEDA) cuyo inicio mejor continúa 'final'
+    int mejorDesplazamiento() {
+        int mejor = 0;
+        float mejorValor = -1e30f;
+        for (int d = 0; d < BUSQUEDA; ++d) {
+            float corr, energia;
+            correlacionYEnergia(entrada.data() + d * CANALES, final.data(), SOLAPE * CANALES, corr, energia);
+            float valor = corr / sqrtf(energia + 1e-9f);
+            if (valor > mejorValor) {
+                mejorValor = valor;
+                mejor = d;
+            }
+        }
+        return mejor;
+    }
+};
+
+// --- Ecualizador paramétrico ---
+//
+// Cascada de biquads (fórmulas del "Audio EQ Cookbook" de R. Bristow-Johnson)
+// aplicada por el hilo de audio a la salida. Los coeficientes se calculan solo
+// cuando cambia la configuración; el hilo de audio los copia sin bloquearse y
+// no reserva memoria. Con SSE2 cada canal va en un carril de un registro de
+// dos doubles, así L y R se filtran a la vez.
+
+struct CoeficientesBiquad {
+    double b0 = 1, b1 = 0, b2 = 0, a1 = 0, a2 = 0;
+};
+
+CoeficientesBiquad calcularBiquad(const BandaEcualizador& banda, double fs) {
+    double f = max(10.0, min(banda.frecuencia, fs * 0.49));
+    double q = max(0.05, banda.q);
+    double A = pow(10.0, banda.gananciaDb / 40.0);
+    double w0 = 2 * M_PI * f / fs;
+    double cs = cos(w0), alpha = sin(w0) / (2 * q), raizA2 = 2 * sqrt(A) * alpha;
+    double b0, b1, b2, a0, a1, a2;
+    switch (banda.tipo) {
+        case FILTRO_GRAVES:
+            b0 = A * ((A + 1) - (A - 1) * cs + raizA2);
+            b1 = 2 * A * ((A - 1) - (A + 1) * cs);
+            b2 = A * ((A + 1) - (A - 1) * cs - raizA2);
+            a0 = (A + 1) + (A - 1) * cs + raizA2;
+            a1 = -2 * ((A - 1) + (A + 1) * cs);
+            a2 = (A + 1) + (A - 1) * cs - raizA2;
+            break;
+        case FILTRO_AGUDOS:
+            b0 = A * ((A + 1) + (A - 1) * cs + raizA2);
+            b1 = -2 * A * ((A - 1) + (A + 1) * cs);
+            b2 = A * ((A + 1) + (A - 1) * cs - raizA2);
+            a0 = (A + 1) - (A - 1) * cs + raizA2;
+            a1 = 2 * ((A - 1) - (A + 1) * cs);
+            a2 = (A + 1) - (A - 1) * cs - raizA2;
+            break;
+        case FILTRO_PASO_BAJO:
+            b0 = (1 - cs) / 2; b1 = 1 - cs; b2 = (1 - cs) / 2;
+            a0 = 1 + alpha; a1 = -2 * cs; a2 = 1 - alpha;
+            break;
+        case FILTRO_PASO_ALTO:
+            b0 = (1 + cs) / 2; b1 = -(1 + cs); b2 = (1 + cs) / 2;
+            a0 = 1 + alpha; a1 = -2 * cs; a2 = 1 - alpha;
+            break;
+        default: // FILTRO_PICO
+            b0 = 1 + alpha * A; b1 = -2 * cs; b2 = 1 - alpha * A;
+            a0 = 1 + alpha / A; a1 = -2 * cs; a2 = 1 - alpha / A;
+            break;
+    }
+    CoeficientesBiquad c;
+    c.b0 = b0 / a0; c.b1 = b1 / a0; c.b2 = b2 / a0; c.a1 = a1 / a0; c.a2 = a2 / a0;
+    return c;
+}
+
+class Ecualizador {
+public:
+    // Llamado desde la interfaz: calcula y publica los coeficientes
+    void configurar(const vector<BandaEcualizador>& bandas) {
+        lock_guard<mutex> lk(mtx);
+        publicadas = (int)min<size_t>(bandas.size(), MAX_BANDAS);
+        for (int i = 0; i < publicadas; ++i) coefPublicados[i] = calcularBiquad(bandas[i], FRECUENCIA_MUESTREO);
+        version++;
+    }
+
+    // Llamado desde el hilo de audio: filtra en el lugar 'frames' frames intercalados
+    void procesar(float* datos, size_t frames) {
+        actualizar();
+#if defined(__SSE2__)
+        if (CANALES == 2) {
+            procesarSimd(datos, frames);
+            return;
+        }
+#endif
+        procesarEscalar(datos, frames);
+    }
+
+    // Versión sin SIMD (otros números de canales o CPU sin SSE2), también para comparar
+    void procesarEscalar(float* datos, size_t frames) {
+        for (size_t f = 0; f < frames; ++f) {
+            for (int c = 0; c < CANALES; ++c) {
+                double x = datos[f * CANALES + c];
+                for (int b = 0; b < bandas; ++b) {
+                    const CoeficientesBiquad& k = coef[b];
+                    double y = k.b0 * x + z1[b][c];
+                    z1[b][c] = k.b1 * x - k.a1 * y + z2[b][c];
+                    z2[b][c] = k.b2 * x - k.a2 * y;
+                    x = y;
+                }
+                datos[f * CANALES + c] = (float)x;
+            }
+        }
+    }
+
+#if defined(__SSE2__)
+    void procesarSimd(float* datos, size_t frames) {
+        __m128d b0[MAX_BANDAS], b1[MAX_BANDAS], b2[MAX_BANDAS], a1[MAX_BANDAS], a2[MAX_BANDAS];
+        __m128d s1[MAX_BANDAS], s2[MAX_BANDAS];
+        for (int b = 0; b < bandas; ++b) {
+            b0[b] = _mm_set1_pd(coef[b].b0); b1[b] = _mm_set1_pd(coef[b].b1); b2[b] = _mm_set1_pd(coef[b].b2);
+            a1[b] = _mm_set1_pd(coef[b].a1); a2[b] = _mm_set1_pd(coef[b].a2);
+            s1[b] = _mm_loadu_pd(z1[b]);
+            s2[b] = _mm_loadu_pd(z2[b]);
+        }
+        for (size_t f = 0; f < frames; ++f) {
+            float* p = datos + f * 2;
+            __m128d x = _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))));
+            for (int b = 0; b < bandas; ++b) {
+                __m128d y = _mm_add_pd(_mm_mul_pd(b0[b], x), s1[b]);
+                s1[b] = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(b1[b], x), _mm_mul_pd(a1[b], y)), s2[b]);
+                s2[b] = _mm_sub_pd(_mm_mul_pd(b2[b], x), _mm_mul_pd(a2[b], y));
+                x = y;
+            }
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(p), _mm_castps_si128(_mm_cvtpd_ps(x)));
+        }
+        for (int b = 0; b < bandas; ++b) {
+            _mm_storeu_pd(z1[b], s1[b]);
+            _mm_storeu_pd(z2[b], s2[b]);
+        }
+    }
+#endif
+
+    int numBandas() const { return bandas; }
+
+private:
+    // Lado de la interfaz (protegido por mtx)
+    mutex mtx;
+    CoeficientesBiquad coefPublicados[MAX_BANDAS];
+    int publicadas = 0;
+    unsigned version = 0;
+
+    // Lado del hilo de audio
+    CoeficientesBiquad coef[MAX_BANDAS];
+    int bandas = 0;
+    unsigned versionAplicada = 0;
+    double z1[MAX_BANDAS][CANALES] = {};
+    double z2[MAX_BANDAS][CANALES] = {};
+
+    // Toma coeficientes nuevos si los hay; si la interfaz está escribiendo, lo intenta en el próximo bloque
+    void actualizar() {
+        if (!mtx.try_lock()) return;
+        if (version != versionAplicada) {
+            if (publicadas != bandas) {
+                memset(z1, 0, sizeof(z1));
+                memset(z2, 0, sizeof(z2));
+            }
+            bandas = publicadas;
+            memcpy(coef, coefPublicados, sizeof(coef));
+            versionAplicada = version;
+        }
+        mtx.unlock();
+    }
+};
+
+Ecualizador ecualizador; // Uno por salida: SimplePlayer tiene una sola (ffplay)
+
+// Costo por banda del ecualizador, con y sin SIMD
+int medirEcualizador() {
+    const size_t frames = FRECUENCIA_MUESTREO * 10;
+    vector<float> ruido(frames * CANALES);
+    mt19937 g(1);
+    uniform_real_distribution<float> dist(-0.5f, 0.5f);
+    for (float& v : ruido) v = dist(g);
+    vector<float> datos(ruido.size());
+
+    cout << "Ecualizador: 10 s de audio estéreo a " << FRECUENCIA_MUESTREO << " Hz" << endl;
+    cout << "bandas  ns/frame (SIMD)  ns/frame (escalar)  ns/frame/banda (SIMD)  veces tiempo real (SIMD)" << endl;
+    for (int n = 1; n <= MAX_BANDAS; ++n) {
+        vector<BandaEcualizador> bandas(n);
+        for (int i = 0; i < n; ++i) {
+            bandas[i].tipo = (TipoFiltro)(i % NUM_FILTROS);
+            bandas[i].frecuencia = 60.0 * pow(2.0, i);
+            bandas[i].gananciaDb = (i % 2) ? 3.0 : -3.0;
+        }
+        double ns[2];
+        for (int modo = 0; modo < 2; ++modo) {
+            Ecualizador eq;
+            eq.configurar(bandas);
+            eq.procesar(datos.data(), 0); // Tomar los coeficientes
+            datos = ruido;
+            auto inicio = chrono::steady_clock::now();
+#if defined(__SSE2__)
+            if (modo == 0) eq.procesarSimd(datos.data(), frames);
+            else
+#endif
+            eq.procesarEscalar(datos.data(), frames);
+            ns[modo] = chrono::duration<double, nano>(chrono::steady_clock::now() - inicio).count() / frames;
+        }
+        cout << setw(6) << n << fixed << setprecision(1)
+             << setw(17) << ns[0] << setw(20) << ns[1] << setw(23) << ns[0] / n
+             << setw(26) << setprecision(0) << 1e9 / (ns[0] * FRECUENCIA_MUESTREO) << endl;
+    }
+    return 0;
+}
+
+// --- Tubería de audio: ffmpeg decodifica, SimplePlayer transfiere y ffplay suena ---
+//
+// Cada canción suena a través de dos procesos: ffmpeg decodifica el archivo a
+// PCM y ffplay lo reproduce leyendo de su entrada estándar. Separarlos permite
+// tener lista la siguiente canción (la reserva): ambos procesos ya lanzados, el
+// archivo abierto y los primeros bloques decodificados esperando en la tubería,
+// y ffplay con el dispositivo ya abierto, sonando en silencio a la espera de
+// audio. Al cambiar de pista solo hay que empezar a transferir, en lugar de
+// pagar fork, exec, enlazado, inicio de códecs y apertura del dispositivo.
+
+const int TAMANO_TUBERIA = 1024 * 1024;  // ~3 s de audio decodificado en espera
+const int CEBADO_RESERVA_MS = 200;       // Silencio inicial de la reserva; cabe en la tubería hacia ffplay
+
+struct Tuberia {
+    string ruta;
+    pid_t pidDecodificador = 0;  // ffmpeg
+    pid_t pidSalida = 0;         // ffplay
+    int fdPcm = -1;              // Lectura del PCM que produce ffmpeg
+    int fdSalida = -1;           // Escritura hacia la entrada de ffplay
+};
+
+Tuberia tuberiaActual;           // Pids de la canción que suena (los fd son del hilo de audio)
+Tuberia reserva;                 // Siguiente canción, lanzada y en espera
+thread hiloAudio;
+atomic<bool> audioSalir(false);
+
+// Latencia de cambio de pista: desde la orden hasta que ffplay recibe audio
+class LatenciaCambio {
+public:
+    void registrar(bool desdeReserva, double ms) {
+        lock_guard<mutex> lk(mtx);
+        if (desdeReserva) { msReserva += ms; nReserva++; }
+        else { msFrio += ms; nFrio++; }
+    }
+
+    string resumen() {
+        lock_guard<mutex> lk(mtx);
+        ostringstream out;
+        out << "Cambio de pista: reserva " << (nReserva ? (long)(msReserva / nReserva) : 0) << " ms (" << nReserva << ")"
+            << " | en frío " << (nFrio ? (long)(msFrio / nFrio) : 0) << " ms (" << nFrio << ")";
+        return out.str();
+    }
+
+private:
+    mutex mtx;
+    double msReserva = 0, msFrio = 0;
+    int nReserva = 0, nFrio = 0;
+};
+
+LatenciaCambio latenciaCambio;
+
+// Qué parte de la canción corresponde a cada punto de lo enviado a ffplay.
+// Con el estirador la salida no avanza al ritmo de la canción, y entre lo
+// escrito y lo que suena quedan la tubería y el buffer de ffplay: el hilo de
+// audio anota marcas (frames escritos, frames de canción cubiertos) y el
+// controlador, que sabe cuánto lleva sonando, las traduce a tiempo de canción
+class MapaContenido {
+public:
+    // Audio nuevo: nada escrito todavía
+    void reiniciar() {
+        lock_guard<mutex> lk(mtx);
+        marcas.assign(1, Marca());
+    }
+
+    // Hilo de audio, tras cada bloque escrito; ambos valores acumulados
+    void anotar(int64_t salida, int64_t contenido) {
+        lock_guard<mutex> lk(mtx);
+        marcas.push_back({salida, contenido});
+    }
+
+    // Segundos de canción que ya sonaron tras 'segundosSonando' de salida
+    // real. Las marcas ya superadas se descartan
+    double segundosOidos(double segundosSonando) {
+        lock_guard<mutex> lk(mtx);
+        int64_t oida = (int64_t)(segundosSonando * FRECUENCIA_MUESTREO);
+        while (marcas.size() >= 2 && marcas[1].salida <= oida) marcas.pop_front();
+        const Marca& a = marcas[0];
+        if (marcas.size() == 1) return (double)a.contenido / FRECUENCIA_MUESTREO;  // ffplay se quedó sin audio
+        const Marca& b = marcas[1];
+        double t = (double)(max(oida, a.salida) - a.salida) / (b.salida - a.salida);
+        return (a.contenido + t * (b.contenido - a.contenido)) / FRECUENCIA_MUESTREO;
+    }
+
+private:
+    struct Marca {
+        int64_t salida = 0;     // Frames enviados a ffplay
+        int64_t contenido = 0;  // Frames de la canción que cubren
+    };
+    mutex mtx;
+    deque<Marca> marcas{Marca()};
+};
+
+MapaContenido mapaContenido;
+
+// Lanza un proceso con la entrada, salida y errores indicados (-1 = /dev/null)
+pid_t lanzarProceso(const vector<string>& args, int fdEntrada, int fdSalida, int fdError = -1) {
+    // Preparar argv antes de fork: en el hijo solo llamadas seguras
+    vector<char*> argv;
+    for (const string& a : args) argv.push_back(const_cast<char*>(a.c_str()));
+    argv.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_RDWR);
+        dup2(fdEntrada >= 0 ? fdEntrada : devnull, STDIN_FILENO);
+        dup2(fdSalida >= 0 ? fdSalida : devnull, STDOUT_FILENO);
+        dup2(fdError >= 0 ? fdError : devnull, STDERR_FILENO);
+        if (devnull > STDERR_FILENO) close(devnull);
+        signal(SIGPIPE, SIG_DFL);
+        execvp(argv[0], argv.data());
+        _exit(1);
+    }
+    return pid;
+}
+
+const uint32_t WAV_TAMANO_DESCONOCIDO = 0xFFFFFFFF;
+
+// Cabecera WAV PCM de 16 bits en little-endian. Con tamaño "desconocido"
+// ffplay lee hasta EOF
+void armarCabeceraWav(uint8_t (&h)[44], uint32_t tamData) {
+    auto u32 = [&](int pos, uint32_t v) { for (int i = 0; i < 4; ++i) h[pos + i] = (v >> (8 * i)) & 0xFF; };
+    auto u16 = [&](int pos, uint16_t v) { h[pos] = v & 0xFF; h[pos + 1] = v >> 8; };
+    uint32_t tamRiff = tamData == WAV_TAMANO_DESCONOCIDO ? WAV_TAMANO_DESCONOCIDO : tamData + 36;
+    memcpy(h, "RIFF", 4);      u32(4, tamRiff);
+    memcpy(h + 8, "WAVEfmt ", 8); u32(16, 16);
+    u16(20, 1);                u16(22, CANALES);
+    u32(24, FRECUENCIA_MUESTREO);
+    u32(28, FRECUENCIA_MUESTREO * CANALES * 2);
+    u16(32, CANALES * 2);      u16(34, 16);
+    memcpy(h + 36, "data", 4); u32(40, tamData);
+}
+
+void escribirCabeceraWav(int fd) {
+    uint8_t h[44];
+    armarCabeceraWav(h, WAV_TAMANO_DESCONOCIDO);
+    escribirTodo(fd, h, sizeof(h));
+}
+
+// ffmpeg decodificando a PCM intercalado (formato "f32le" o "s16le") por stdout
+vector<string> argumentosDecodificador(const string& ruta, int segundoInicio, const string& formato) {
+    vector<string> args = {"ffmpeg", "-nostdin", "-v", "quiet"};
+    if (segundoInicio > 0) {
+        // Saltar tiempo antes de abrir la entrada (búsqueda rápida)
+        args.push_back("-ss");
+        args.push_back(to_string(segundoInicio));
+    }
+    for (const string& a : {string("-i"), ruta, string("-vn"), string("-f"), formato,
+                            string("-ar"), to_string(FRECUENCIA_MUESTREO),
+                            string("-ac"), to_string(CANALES), string("pipe:1")}) {
+        args.push_back(a);
+    }
+    return args;
+}
+
+// Lanza decodificador y ffplay conectados por tuberías; no transfiere nada aún
+Tuberia prepararTuberia(const string& ruta, int segundoInicio) {
+    Tuberia t;
+    t.ruta = ruta;
+    int pcm[2], salida[2];
+    if (pipe2(pcm, O_CLOEXEC) != 0) return t;
+    if (pipe2(salida, O_CLOEXEC) != 0) {
+        close(pcm[0]);
+        close(pcm[1]);
+        return t;
+    }
+    fcntl(pcm[1], F_SETPIPE_SZ, TAMANO_TUBERIA);
+
+    t.pidDecodificador = lanzarProceso(argumentosDecodificador(ruta, segundoInicio, "f32le"), -1, pcm[1]);
+    t.pidSalida = lanzarProceso({"ffplay", "-nodisp", "-autoexit", "-loglevel", "quiet", "pipe:0"}, salida[0], -1);
+    close(pcm[1]);
+    close(salida[0]);
+    t.fdPcm = pcm[0];
+    t.fdSalida = salida[1];
+    escribirCabeceraWav(t.fdSalida);
+    return t;
+}
+
+// Espera a que ffplay empiece a consumir lo ya escrito en su tubería
+void esperarConsumo(int fd, size_t escritos) {
+    auto limite = chrono::steady_clock::now() + chrono::seconds(3);
+    while (!audioSalir && chrono::steady_clock::now() < limite) {
+        int pendientes = 0;
+        if (ioctl(fd, FIONREAD, &pendientes) != 0 || (size_t)pendientes < escritos) return;
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+}
+
+// Hilo de audio: pasa el PCM del decodificador a ffplay hasta el final de la
+// canción y, si terminó sola, avisa con alTerminar
+void transferirAudio(Tuberia t, chrono::steady_clock::time_point inicioCambio, bool medir, bool desdeReserva,
+                     function<void()> alTerminar) {
+    vector<float> entrada(FRAMES_BLOQUE * CANALES);
+    vector<float> estirado;
+    vector<int16_t> salida;
+    // A velocidad mínima la salida duplica la entrada, más una secuencia pendiente
+    size_t maxSalida = (size_t)(FRAMES_BLOQUE / VELOCIDAD_MINIMA + EstiradorTiempo::SECUENCIA) * CANALES;
+    estirado.reserve(maxSalida);
+    salida.reserve(maxSalida);
+    EstiradorTiempo estirador;
+    const size_t bytesFrame = sizeof(float) * CANALES;
+    size_t bytesParciales = 0; // Restos de un frame incompleto
+    bool primerBloque = true;
+    bool estirando = false;    // El estirador tiene audio pendiente
+    int64_t framesLeidos = 0, framesEscritos = 0;
+#if defined(__SSE__)
+    // Desnormales a cero: la cola de los filtros en silencio no debe frenar el hilo
+    _mm_setcsr(_mm_getcsr() | 0x8040);
+#endif
+
+    while (!audioSalir) {
+        char* base = reinterpret_cast<char*>(entrada.data());
+        ssize_t n = read(t.fdPcm, base + bytesParciales, entrada.size() * sizeof(float) - bytesParciales);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break; // Fin de la canción o decodificador detenido
+
+        size_t bytes = bytesParciales + n;
+        size_t frames = bytes / bytesFrame;
+        framesLeidos += frames;
+
+        // Cambio de velocidad; a velocidad normal el audio pasa sin tocar
+        float* bloque = entrada.data();
+        size_t framesSalida = frames;
+        double tempo = velocidad;
+        if (tempo != 1.0 || estirando) {
+            estirado.clear();
+            if (tempo != 1.0) estirador.procesar(entrada.data(), frames, tempo, estirado);
+            else estirador.vaciar(entrada.data(), frames, estirado);
+            estirando = tempo != 1.0;
+            bloque = estirado.data();
+            framesSalida = estirado.size() / CANALES;
+        }
+        ecualizador.procesar(bloque, framesSalida);
+
+        size_t muestras = framesSalida * CANALES;
+        salida.resize(muestras);
+        for (size_t i = 0; i < muestras; ++i) {
+            float v = bloque[i] * 32767.0f;
+            salida[i] = (int16_t)(v > 32767.0f ? 32767.0f : (v < -32768.0f ? -32768.0f : v));
+        }
+        if (!escribirTodo(t.fdSalida, salida.data(), muestras * sizeof(int16_t))) break;
+        framesEscritos += framesSalida;
+        mapaContenido.anotar(framesEscritos, framesLeidos - estirador.retraso());
+
+        bytesParciales = bytes - frames * bytesFrame;
+        memmove(base, base + frames * bytesFrame, bytesParciales);
+
+        if (primerBloque && muestras > 0) {
+            primerBloque = false;
+            if (medir) {
+                esperarConsumo(t.fdSalida, muestras * sizeof(int16_t));
+                double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - inicioCambio).count();
+                latenciaCambio.registrar(desdeReserva, ms);
+            }
+        }
+    }
+    // Cerrar la entrada de ffplay: con -autoexit termina al vaciar su buffer
+    close(t.fdPcm);
+    close(t.fdSalida);
+
+    // Esperar a que ffplay termine sin recogerlo: mientras siga como zombi su
+    // PID no se reutiliza, y pausar o detener nunca señalan a otro proceso
+    siginfo_t info;
+    while (t.pidSalida > 0 && waitid(P_PID, t.pidSalida, &info, WEXITED | WNOWAIT) != 0 && errno == EINTR) {}
+    if (!audioSalir && alTerminar) alTerminar();
+}
+
+// Señala ambos procesos; SIGCONT por si estaban pausados con SIGSTOP
+void senalarTuberia(const Tuberia& t, pid_t salida) {
+    for (pid_t pid : {salida, t.pidDecodificador}) {
+        if (pid > 0) {
+            kill(pid, SIGTERM);
+            kill(pid, SIGCONT);
+        }
+    }
+}
+
+void detenerTuberiaActual() {
+    // Con audioSalir el hilo de audio ya no toma la salida de ffplay como fin de canción
+    pid_t salida = tuberiaActual.pidSalida;
+    audioSalir = true;
+    senalarTuberia(tuberiaActual, salida);
+    if (hiloAudio.joinable()) hiloAudio.join();
+    if (salida > 0) waitpid(salida, nullptr, 0);
+    if (tuberiaActual.pidDecodificador > 0) waitpid(tuberiaActual.pidDecodificador, nullptr, 0);
+    tuberiaActual = Tuberia();
+}
+
+void descartarReserva() {
+    if (reserva.pidSalida == 0 && reserva.pidDecodificador == 0) return;
+    senalarTuberia(reserva, reserva.pidSalida);
+    if (reserva.fdPcm >= 0) close(reserva.fdPcm);
+    if (reserva.fdSalida >= 0) close(reserva.fdSalida);
+    if (reserva.pidSalida > 0) waitpid(reserva.pidSalida, nullptr, 0);
+    if (reserva.pidDecodificador > 0) waitpid(reserva.pidDecodificador, nullptr, 0);
+    reserva = Tuberia();
+}
+
+// Deja lista la canción indicada para arrancar sin espera (vacío = ninguna).
+// Con solo la cabecera ffplay se quedaría analizando el formato hasta el
+// cambio de pista; un poco de silencio le basta para iniciar el decodificador
+// y abrir el dispositivo ahora. Después espera datos sin sonar nada audible
+void prepararReserva(const string& ruta) {
+    if (reserva.ruta == ruta) return;
+    descartarReserva();
+    if (ruta.empty()) return;
+    reserva = prepararTuberia(ruta, 0);
+    if (reserva.fdSalida >= 0) {
+        vector<int16_t> silencio((size_t)FRECUENCIA_MUESTREO * CEBADO_RESERVA_MS / 1000 * CANALES);
+        escribirTodo(reserva.fdSalida, silencio.data(), silencio.size() * sizeof(int16_t));
+    }
+}
+
+// Función para reproducir desde una posición específica
+void reproducirDesdeSegundo(const Cancion& cancion, int segundoInicio, function<void()> alTerminar) {
+    auto inicioCambio = chrono::steady_clock::now();
+    string ruta = cancion.ruta();
+    
+    // Detener reproducción anterior si existe
+    detenerTuberiaActual();
+
+    // Usar la reserva si es justo esta canción desde el inicio
+    bool desdeReserva = segundoInicio == 0 && reserva.pidSalida > 0 && reserva.ruta == ruta;
+    if (desdeReserva) {
+        tuberiaActual = reserva;
+        reserva = Tuberia();
+    } else {
+        tuberiaActual = prepararTuberia(ruta, segundoInicio);
+    }
+
+    audioSalir = false;
+    mapaContenido.reiniciar();
+    hiloAudio = thread(transferirAudio, tuberiaActual, inicioCambio, segundoInicio == 0, desdeReserva, move(alTerminar));
+}
+
+void pausarTuberia() {
+    if (tuberiaActual.pidSalida > 0) kill(tuberiaActual.pidSalida, SIGSTOP);
+}
+
+void reanudarTuberia() {
+    if (tuberiaActual.pidSalida > 0) kill(tuberiaActual.pidSalida, SIGCONT);
+}
+
+// --- Controlador de la reproducción (PlayerController) ---
+//
+// Todo el estado de la reproducción pertenece a un único hilo: el del
+// controlador. Los demás (la interfaz, el hilo de audio, quien sea) solo le
+// envían órdenes por una cola MPSC sin bloqueos y leen una instantánea del
+// estado. Como las órdenes se aplican de a una y en orden de llegada, no hay
+// banderas que coordinar: el fin natural de una canción llega como una orden
+// más, marcada con la generación del audio que terminó, y se descarta si para
+// entonces ya suena otra cosa.
+
+// Cola de Vyukov: varios productores con un intercambio atómico cada uno,
+// un solo consumidor
+template <typename T>
+class ColaMPSC {
+public:
+    ColaMPSC() : cabeza(new Nodo()), cola(cabeza.load()) {}
+
+    ~ColaMPSC() {
+        T valor;
+        while (sacar(valor)) {}
+        delete cola;
+    }
+
+    ColaMPSC(const ColaMPSC&) = delete;
+    ColaMPSC& operator=(const ColaMPSC&) = delete;
+
+    // Cualquier hilo
+    void empujar(T valor) {
+        Nodo* nodo = new Nodo();
+        nodo->valor = move(valor);
+        Nodo* previo = cabeza.exchange(nodo, memory_order_acq_rel);
+        previo->siguiente.store(nodo, memory_order_release);
+    }
+
+    // Solo el consumidor
+    bool sacar(T& valor) {
+        Nodo* siguiente = cola->siguiente.load(memory_order_acquire);
+        if (!siguiente) return false;
+        valor = move(siguiente->valor);
+        delete cola;
+        cola = siguiente;
+        return true;
+    }
+
+    // Solo el consumidor; un productor a medio empujar todavía cuenta como vacía
+    bool vacia() const { return cola->siguiente.load(memory_order_acquire) == nullptr; }
+
+private:
+    struct Nodo {
+        atomic<Nodo*> siguiente{nullptr};
+        T valor;
+    };
+    atomic<Nodo*> cabeza;  // Último nodo empujado
+    Nodo* cola;            // Nodo ya consumido; el siguiente es el primero pendiente
+};
+
+// Lo que el controlador necesita de la salida de audio. Se llama solo desde
+// el hilo del controlador.
+class SalidaAudio {
+public:
+    virtual ~SalidaAudio() = default;
+    // Empieza a sonar desde 'segundo'; si la canción termina sola, llama a alTerminar
+    virtual void iniciar(const Cancion& cancion, int segundo, function<void()> alTerminar) = 0;
+    virtual void detener() = 0;
+    virtual void pausar() = 0;
+    virtual void reanudar() = 0;
+    virtual void reservar(const string& ruta) = 0;  // Siguiente canción a dejar lista; vacío = ninguna
+    // Segundos de canción, desde el 'segundo' de iniciar, que ya sonaron tras
+    // 'segundosSonando' de reproducción sin pausas
+    virtual double segundosOidos(double segundosSonando) = 0;
+};
+
+// La tubería ffmpeg -> SimplePlayer -> ffplay
+class SalidaTuberia : public SalidaAudio {
+public:
+    void iniciar(const Cancion& cancion, int segundo, function<void()> alTerminar) override {
+        reproducirDesdeSegundo(cancion, segundo, move(alTerminar));
+    }
+    void detener() override { detenerTuberiaActual(); }
+    void pausar() override { pausarTuberia(); }
+    void reanudar() override { reanudarTuberia(); }
+    void reservar(const string& ruta) override { prepararReserva(ruta); }
+    double segundosOidos(double segundosSonando) override { return mapaContenido.segundosOidos(segundosSonando); }
+};
+
+enum EstadoReproductor { DETENIDO, REPRODUCIENDO, PAUSADO };
+
+const int SALTO_SEGUNDOS = 10;  // Avance rápido y retroceso
+
+struct InstantaneaReproductor {
+    EstadoReproductor estado = DETENIDO;
+    size_t posicion = 0;            // Canción actual dentro de la cola
+    size_t totalCola = 0;
+    Cancion cancion;
+    int segundos = 0;               // Tiempo de canción, no real: sigue a la velocidad
+    int duracion = 0;
+    uint64_t pistasIniciadas = 0;   // Cambia cada vez que empieza una canción (no al buscar)
+    bool colaTerminada = false;     // Se detuvo porque la última canción terminó sola
+    uint64_t ordenesProcesadas = 0;
+};
+
+class PlayerController {
+public:
+    // Se llama, desde el hilo del controlador, cada vez que se deja una canción
+    using AlDejarPista = function<void(const Cancion&, TipoEvento, int segundos)>;
+
+    PlayerController(SalidaAudio& salida, AlDejarPista alDejar = nullptr)
+        : salida(salida), alDejar(move(alDejar)) {
+        hilo = thread(&PlayerController::bucle, this);
+    }
+
+    ~PlayerController() {
+        OrdenReproductor o;
+        o.tipo = ORDEN_SALIR;
+        enviar(move(o));
+        hilo.join();
+    }
+
+    // --- Órdenes: vuelven de inmediato y se aplican en orden de llegada ---
+
+    // Reemplaza la cola. Si en 'posicion' está la canción que ya suena (por
+    // ejemplo al mezclar), sigue sonando sin cortes.
+    void establecerCola(vector<Cancion> canciones, size_t posicion, bool reproducir) {
+        OrdenReproductor o;
+        o.tipo = ORDEN_COLA;
+        o.canciones = move(canciones);
+        o.valor = (int64_t)posicion;
+        o.reproducir = reproducir;
+        enviar(move(o));
+    }
+
+    void agregarACola(vector<Cancion> canciones) {
+        OrdenReproductor o;
+        o.tipo = ORDEN_AGREGAR;
+        o.canciones = move(canciones);
+        enviar(move(o));
+    }
+
+    // Desde el inicio la canción en 'posicion' (-1 = la actual)
+    void reproducir(int64_t posicion = -1) { enviar(ORDEN_REPRODUCIR, posicion); }
+    void pausar() { enviar(ORDEN_PAUSAR); }
+    void reanudar() { enviar(ORDEN_REANUDAR); }
+    void alternarPausa() { enviar(ORDEN_ALTERNAR_PAUSA); }
+    // Segundos relativos a la posición actual; pasado el final avanza como al
+    // terminar, pero la canción cuenta como saltada
+    void buscar(int segundos) { enviar(ORDEN_BUSCAR, segundos); }
+    // +1 siguiente, -1 anterior; fuera de la cola se detiene
+    void saltar(int direccion) { enviar(ORDEN_SALTAR, direccion); }
+    void detener() { enviar(ORDEN_DETENER); }
+
+    // La salida avisa que terminó el audio de esa generación
+    void pistaTerminada(uint64_t generacion) {
+        OrdenReproductor o;
+        o.tipo = ORDEN_FIN_PISTA;
+        o.generacion = generacion;
+        enviar(move(o));
+    }
+
+    // --- Consultas: desde cualquier hilo ---
+
+    InstantaneaReproductor estado() const {
+        lock_guard<mutex> lk(mtxInstantanea);
+        return instantanea;
+    }
+
+    // Espera a que se apliquen todas las órdenes enviadas hasta ahora
+    void sincronizar() {
+        uint64_t objetivo = enviadas.load();
+        unique_lock<mutex> lk(mtxInstantanea);
+        cvProcesadas.wait(lk, [&] { return instantanea.ordenesProcesadas >= objetivo; });
+    }
+
+private:
+    enum TipoOrden {
+        ORDEN_COLA, ORDEN_AGREGAR, ORDEN_REPRODUCIR, ORDEN_PAUSAR, ORDEN_REANUDAR,
+        ORDEN_ALTERNAR_PAUSA, ORDEN_BUSCAR, ORDEN_SALTAR, ORDEN_DETENER, ORDEN_FIN_PISTA, ORDEN_SALIR
+    };
+
+    struct OrdenReproductor {
+        TipoOrden tipo = ORDEN_DETENER;
+        int64_t valor = 0;
+        uint64_t generacion = 0;
+        bool reproducir = false;
+        vector<Cancion> canciones;
+    };
+
+    SalidaAudio& salida;
+    AlDejarPista alDejar;
+    thread hilo;
+
+    // Entrada de órdenes
+    ColaMPSC<OrdenReproductor> ordenes;
+    atomic<uint64_t> enviadas{0};
+    atomic<bool> esperando{false};   // El controlador va a dormir: hay que despertarlo
+    mutex mtxDespertar;
+    condition_variable cvDespertar;
+
+    // Estado: solo lo toca el hilo del controlador
+    EstadoReproductor estadoActual = DETENIDO;
+    vector<Cancion> cola;
+    size_t posicion = 0;
+    Cancion actual;
+    int duracion = 0;
+    double segundos = 0;
+    int desdeAudio = 0;               // Segundo de la canción donde empezó el audio actual
+    double segundosSonando = 0;       // Tiempo real que lleva sonando, sin las pausas
+    chrono::steady_clock::time_point ultimoTic;
+    uint64_t generacion = 0;          // Audio lanzado: cambia también al buscar
+    uint64_t pistasIniciadas = 0;
+    bool colaTerminada = false;
+    uint64_t procesadas = 0;
+    bool salir = false;
+
+    // Lo que ven los demás hilos
+    mutable mutex mtxInstantanea;
+    condition_variable cvProcesadas;
+    InstantaneaReproductor instantanea;
+
+    void enviar(TipoOrden tipo, int64_t valor = 0) {
+        OrdenReproductor o;
+        o.tipo = tipo;
+        o.valor = valor;
+        enviar(move(o));
+    }
+
+    void enviar(OrdenReproductor o) {
+        enviadas++;
+        ordenes.empujar(move(o));
+        // Pareja del fence en bucle(): o el controlador ve la orden antes de
+        // dormir, o nosotros vemos que duerme y lo despertamos
+        atomic_thread_fence(memory_order_seq_cst);
+        if (esperando.load(memory_order_relaxed)) {
+            lock_guard<mutex> lk(mtxDespertar);
+            cvDespertar.notify_one();
+        }
+    }
+
+    void bucle() {
+        ultimoTic = chrono::steady_clock::now();
+        while (!salir) {
+            OrdenReproductor o;
+            while (!salir && ordenes.sacar(o)) {
+                aplicar(o);
+                procesadas++;
+            }
+            avanzarReloj();
+            // Respaldo por si la salida nunca avisa el final
+            if (estadoActual == REPRODUCIENDO && segundos >= duracion) terminarPista();
+            publicar();
+            if (salir) break;
+
+            esperando.store(true, memory_order_relaxed);
+            atomic_thread_fence(memory_order_seq_cst);
+            if (ordenes.vacia()) {
+                unique_lock<mutex> lk(mtxDespertar);
+                auto hayOrdenes = [&] { return !ordenes.vacia(); };
+                // Mientras suena, despertar a menudo para llevar el reloj
+                if (estadoActual == REPRODUCIENDO) cvDespertar.wait_for(lk, chrono::milliseconds(250), hayOrdenes);
+                else cvDespertar.wait(lk, hayOrdenes);
+            }
+            esperando.store(false, memory_order_relaxed);
+        }
+    }
+
+    void aplicar(OrdenReproductor& o) {
+        avanzarReloj();
+        switch (o.tipo) {
+            case ORDEN_COLA: {
+                size_t p = (size_t)max<int64_t>(0, o.valor);
+                bool misma = estadoActual != DETENIDO && p < o.canciones.size() && o.canciones[p].ruta() == actual.ruta();
+                if (!misma && estadoActual != DETENIDO) dejarPista(EVENTO_SALTADA);
+                cola = move(o.canciones);
+                posicion = cola.empty() ? 0 : min(p, cola.size() - 1);
+                colaTerminada = false;
+                if (misma) reservarSiguiente();
+                else if (o.reproducir && p < cola.size()) iniciarPista(p, 0);
+                break;
+            }
+            case ORDEN_AGREGAR:
+                for (Cancion& c : o.canciones) cola.push_back(move(c));
+                if (estadoActual != DETENIDO) reservarSiguiente();
+                break;
+            case ORDEN_REPRODUCIR: {
+                size_t p = o.valor < 0 ? posicion : (size_t)o.valor;
+                if (p >= cola.size()) break;
+                if (estadoActual != DETENIDO) dejarPista(EVENTO_SALTADA);
+                iniciarPista(p, 0);
+                break;
+            }
+            case ORDEN_PAUSAR:
+                if (estadoActual == REPRODUCIENDO) pausarPista();
+                break;
+            case ORDEN_REANUDAR:
+                if (estadoActual == PAUSADO) reanudarPista();
+                break;
+            case ORDEN_ALTERNAR_PAUSA:
+                if (estadoActual == REPRODUCIENDO) pausarPista();
+                else if (estadoActual == PAUSADO) reanudarPista();
+                break;
+            case ORDEN_BUSCAR: {
+                if (estadoActual == DETENIDO) break;
+                int64_t destino = max<int64_t>(0, (int64_t)segundos + o.valor);
+                if (destino >= duracion) {
+                    // Lo decidió el usuario: cuenta como saltada
+                    terminarPista(EVENTO_SALTADA);
+                    break;
+                }
+                // Misma canción, audio nuevo: se conserva la pausa
+                salida.detener();
+                segundos = (double)destino;
+                lanzarAudio((int)destino);
+                if (estadoActual == PAUSADO) salida.pausar();
+                break;
+            }
+            case ORDEN_SALTAR: {
+                int64_t destino = (int64_t)posicion + o.valor;
+                if (estadoActual != DETENIDO) dejarPista(EVENTO_SALTADA);
+                colaTerminada = false;
+                if (destino >= 0 && destino < (int64_t)cola.size()) iniciarPista((size_t)destino, 0);
+                break;
+            }
+            case ORDEN_DETENER:
+                if (estadoActual != DETENIDO) dejarPista(EVENTO_SALTADA);
+                break;
+            case ORDEN_FIN_PISTA:
+                // Un final que llega tarde, de un audio ya reemplazado, no avanza nada
+                if (o.generacion == generacion && estadoActual != DETENIDO) terminarPista();
+                break;
+            case ORDEN_SALIR:
+                if (estadoActual != DETENIDO) dejarPista(EVENTO_SALTADA);
+                salida.detener();
+                salida.reservar("");
+                salir = true;
+                break;
+        }
+    }
+
+    void avanzarReloj() {
+        auto ahora = chrono::steady_clock::now();
+        if (estadoActual == REPRODUCIENDO) {
+            // ffplay suena siempre a ritmo real; cuánta canción cubre eso lo sabe la salida
+            segundosSonando += chrono::duration<double>(ahora - ultimoTic).count();
+            segundos = min(desdeAudio + salida.segundosOidos(segundosSonando), (double)duracion);
+        }
+        ultimoTic = ahora;
+    }
+
+    void lanzarAudio(int desde) {
+        uint64_t g = ++generacion;
+        desdeAudio = desde;
+        segundosSonando = 0;
+        salida.iniciar(actual, desde, [this, g] { pistaTerminada(g); });
+    }
+
+    // DETENIDO -> REPRODUCIENDO
+    void iniciarPista(size_t p, int desde) {
+        posicion = p;
+        actual = cola[p];
+        duracion = (int)(actual.duracion_minutos * 60);
+        segundos = desde;
+        pistasIniciadas++;
+        colaTerminada = false;
+        lanzarAudio(desde);
+        estadoActual = REPRODUCIENDO;
+        reservarSiguiente();
+    }
+
+    // REPRODUCIENDO/PAUSADO -> DETENIDO
+    void dejarPista(TipoEvento tipo) {
+        salida.detener();
+        estadoActual = DETENIDO;
+        if (alDejar) alDejar(actual, tipo, (int)segundos);
+    }
+
+    // Fin de la canción (natural o por buscar más allá del final): pasa a la
+    // siguiente o se detiene al final de la cola
+    void terminarPista(TipoEvento tipo = EVENTO_COMPLETA) {
+        dejarPista(tipo);
+        if (posicion + 1 < cola.size()) iniciarPista(posicion + 1, 0);
+        else colaTerminada = true;
+    }
+
+    void pausarPista() {
+        salida.pausar();
+        estadoActual = PAUSADO;
+    }
+
+    void reanudarPista() {
+        salida.reanudar();
+        estadoActual = REPRODUCIENDO;
+    }
+
+    void reservarSiguiente() {
+        salida.reservar(posicion + 1 < cola.size() ? cola[posicion + 1].ruta() : "");
+    }
+
+    void publicar() {
+        {
+            lock_guard<mutex> lk(mtxInstantanea);
+            instantanea.estado = estadoActual;
+            instantanea.posicion = posicion;
+            instantanea.totalCola = cola.size();
+            if (instantanea.pistasIniciadas != pistasIniciadas) instantanea.cancion = actual;
+            instantanea.segundos = (int)segundos;
+            instantanea.duracion = duracion;
+            instantanea.pistasIniciadas = pistasIniciadas;
+            instantanea.colaTerminada = colaTerminada;
+            instantanea.ordenesProcesadas = procesadas;
+        }
+        cvProcesadas.notify_all();
+    }
+};
+
+// Salida que no suena: comprueba que el controlador la use como corresponde
+class SalidaSimulada : public SalidaAudio {
+public:
+    void iniciar(const Cancion&, int, function<void()> alTerminar) override {
+        lock_guard<mutex> lk(mtx);
+        comprobarHilo();
+        if (activa) violaciones++;
+        activa = true;
+        pausada = false;
+        finPedido = false;
+        uint64_t id = ++iniciadas;
+        fin = [this, id, alTerminar = move(alTerminar)] {
+            {
+                lock_guard<mutex> lk(mtx);
+                if (activa && id == iniciadas) finPedido = true;
+            }
+            alTerminar();
+        };
+    }
+    void detener() override {
+        lock_guard<mutex> lk(mtx);
+        comprobarHilo();
+        detenidaConFin = activa && finPedido;
+        activa = false;
+        pausada = false;
+        fin = nullptr;
+    }
+    void pausar() override {
+        lock_guard<mutex> lk(mtx);
+        comprobarHilo();
+        if (!activa || pausada) violaciones++;
+        pausada = true;
+    }
+    void reanudar() override {
+        lock_guard<mutex> lk(mtx);
+        comprobarHilo();
+        if (!activa || !pausada) violaciones++;
+        pausada = false;
+    }
+    void reservar(const string&) override {
+        lock_guard<mutex> lk(mtx);
+        comprobarHilo();
+    }
+    // Sin estirador: la canción avanza lo mismo que el tiempo real
+    double segundosOidos(double segundosSonando) override {
+        lock_guard<mutex> lk(mtx);
+        comprobarHilo();
+        return segundosSonando;
+    }
+
+    // Simula que el audio en curso termina solo; desde cualquier hilo.
+    // false si no había nada sonando.
+    bool terminar() {
+        function<void()> f;
+        {
+            lock_guard<mutex> lk(mtx);
+            f = fin;
+        }
+        if (f) f();
+        return (bool)f;
+    }
+
+    mutex mtx;
+    bool activa = false;
+    bool pausada = false;
+    uint64_t iniciadas = 0;
+    size_t violaciones = 0;
+    bool detenidaConFin = false;  // El último audio detenido había terminado solo
+
+private:
+    function<void()> fin;
+    bool finPedido = false;
+    thread::id hiloDueno;
+
+    // Todas las llamadas deben venir del mismo hilo, el del controlador
+    void comprobarHilo() {
+        if (hiloDueno == thread::id()) hiloDueno = this_thread::get_id();
+        else if (hiloDueno != this_thread::get_id()) violaciones++;
+    }
+};
+
+// simpleplayer --estres [hilos] [órdenes por hilo]
+// Varios hilos disparan órdenes al azar (y finales de canción, vigentes o
+// viejos) contra un controlador con salida simulada, y al final se comprueban
+// los invariantes.
+int probarControlador(size_t hilos, size_t ordenesPorHilo) {
+    SalidaSimulada salida;
+    mutex mtxEventos;
+    size_t eventos = 0, completas = 0;
+    size_t fallas = 0;
+    auto fallar = [&](const string& motivo) {
+        lock_guard<mutex> lk(mtxEventos);
+        if (fallas++ < 10) cerr << "Falla: " << motivo << endl;
+    };
+
+    vector<Cancion> canciones;
+    for (int i = 0; i < 20; ++i) {
+        canciones.emplace_back("Artista " + to_string(i % 5), "Canción " + to_string(i), 3.0 + i % 4, "/tmp", "estres" + to_string(i) + ".mp3");
+    }
+
+    auto inicio = chrono::steady_clock::now();
+    {
+        PlayerController controlador(salida, [&](const Cancion&, TipoEvento tipo, int) {
+            // Solo puede completarse el audio cuyo final llegó: un final viejo que
+            // avanzara la canción siguiente sería el doble avance
+            bool conFin;
+            {
+                lock_guard<mutex> lk(salida.mtx);
+                conFin = salida.detenidaConFin;
+            }
+            if (tipo == EVENTO_COMPLETA && !conFin) fallar("se completó una canción cuyo audio no terminó");
+            lock_guard<mutex> lk(mtxEventos);
+            eventos++;
+            if (tipo == EVENTO_COMPLETA) completas++;
+        });
+        controlador.establecerCola(canciones, 0, true);
+
+        atomic<uint64_t> enviadas(1);  // La cola inicial
+        vector<thread> productores;
+        for (size_t h = 0; h < hilos; ++h) {
+            productores.emplace_back([&, h]() {
+                mt19937 g((unsigned)h + 1);
+                uint64_t propias = 0;
+                for (size_t i = 0; i < ordenesPorHilo; ++i) {
+                    propias++;
+                    switch (g() % 13) {
+                        case 0: controlador.reproducir((int64_t)(g() % (canciones.size() + 2)) - 1); break;
+                        case 1: controlador.pausar(); break;
+                        case 2: controlador.reanudar(); break;
+                        case 3: controlador.alternarPausa(); break;
+                        case 4: controlador.buscar((int)(g() % 121) - 60); break;
+                        case 5: controlador.saltar(g() % 2 ? 1 : -1); break;
+                        case 6: controlador.detener(); break;
+                        case 7: controlador.agregarACola({canciones[g() % canciones.size()]}); break;
+                        case 8:
+                            // Final probablemente viejo: el controlador va atrasado
+                            if (!salida.terminar()) propias--;
+                            break;
+                        case 9:
+                            // Final probablemente vigente
+                            controlador.sincronizar();
+                            if (!salida.terminar()) propias--;
+                            break;
+                        case 10:
+                            // Buscar más allá del final es un salto, no una
+                            // reproducción completa: el observador lo comprueba
+                            controlador.buscar(1 << 20);
+                            break;
+                        default: {
+                            propias--;
+                            InstantaneaReproductor e = controlador.estado();
+                            if (e.estado != DETENIDO && e.posicion >= e.totalCola) fallar("posición fuera de la cola");
+                            if (e.segundos < 0 || e.segundos > e.duracion) fallar("tiempo fuera de la canción");
+                            break;
+                        }
+                    }
+                }
+                enviadas += propias;
+            });
+        }
+        for (thread& t : productores) t.join();
+        controlador.sincronizar();
+
+        // Ninguna orden perdida ni duplicada
+        InstantaneaReproductor e = controlador.estado();
+        if (e.ordenesProcesadas != enviadas) {
+            fallar(to_string(enviadas.load()) + " órdenes enviadas pero " + to_string(e.ordenesProcesadas) + " procesadas");
+        }
+        {
+            lock_guard<mutex> lk(salida.mtx);
+            if (salida.violaciones) fallar(to_string(salida.violaciones) + " usos indebidos de la salida de audio");
+            if ((e.estado != DETENIDO) != salida.activa) fallar("el estado no coincide con la salida");
+            if ((e.estado == PAUSADO) != salida.pausada) fallar("la pausa no coincide con la salida");
+        }
+        // Cada canción iniciada se deja una sola vez: un doble avance sobraría
+        size_t abiertas = e.estado != DETENIDO ? 1 : 0;
+        {
+            lock_guard<mutex> lk(mtxEventos);
+            if (eventos + abiertas != e.pistasIniciadas) {
+                fallar(to_string(e.pistasIniciadas) + " canciones iniciadas pero " + to_string(eventos) + " dejadas");
+            }
+        }
+        cout << e.ordenesProcesadas << " órdenes de " << hilos << " hilos; "
+             << e.pistasIniciadas << " canciones iniciadas, " << completas << " terminadas solas" << endl;
+    }
+    double segundosMuro = chrono::duration<double>(chrono::steady_clock::now() - inicio).count();
+    cout << fixed << setprecision(0) << hilos * ordenesPorHilo / max(segundosMuro, 1e-9) << " órdenes/s" << endl;
+    cout.unsetf(ios::fixed);
+    cout << (fallas ? "FALLÓ: " + to_string(fallas) + " invariantes violados" : string("OK: invariantes respetados")) << endl;
+    return fallas ? 1 : 0;
+}
+
+// --- Prelectura de las próximas canciones ---
+//
+// Con la música en NFS o en discos mecánicos, la primera lectura de cada
+// archivo detiene el arranque de ffplay durante cientos de milisegundos.
+// El precargador recorre en segundo plano las próximas canciones del orden
+// de reproducción y las deja en la caché de páginas del sistema, con un tope
+// total de bytes. Cada vez que cambia el orden se cancela el trabajo pendiente.
+
+const int PRELECTURA_CANCIONES = 3;                        // Canciones a precalentar por delante
+const size_t PRELECTURA_MAX_BYTES = 64 * 1024 * 1024;      // Tope total de bytes precalentados
+const size_t PRELECTURA_BLOQUE = 256 * 1024;               // Tamaño de cada lectura
+
+class Precargador {
+public:
+    Precargador() : hilo(&Precargador::trabajar, this) {}
+
+    ~Precargador() {
+        {
+            lock_guard<mutex> lk(mtx);
+            salir = true;
+            generacion++;
+        }
+        cv.notify_all();
+        if (hilo.joinable()) hilo.join();
+    }
+
+    // Reemplaza la ventana de prelectura; cancela lo que estuviera en curso
+    void programar(const vector<string>& rutas) {
+        {
+            lock_guard<mutex> lk(mtx);
+            if (rutas == ventana) return;
+            ventana = rutas;
+            generacion++;
+        }
+        cv.notify_all();
+    }
+
+    // Contabiliza el arranque de una canción como acierto o fallo
+    void registrarInicio(const string& ruta) {
+        lock_guard<mutex> lk(mtx);
+        inicios++;
+        auto it = calientes.find(ruta);
+        if (it != calientes.end() && it->second.completa) {
+            aciertos++;
+            msAhorrados += it->second.msEnFrio;
+        }
+    }
+
+    // Texto breve con la tasa de aciertos y una estimación del arranque ahorrado.
+    // No es una medida antes/después: suma lo que tardó en frío el primer bloque
+    // de cada acierto, que es lo que ffplay habría esperado como mínimo
+    string resumen() {
+        lock_guard<mutex> lk(mtx);
+        ostringstream out;
+        int tasa = inicios > 0 ? (aciertos * 100) / inicios : 0;
+        out << "Prelectura: " << aciertos << "/" << inicios << " aciertos (" << tasa << "%), "
+            << "~" << (long)msAhorrados << " ms de arranque ahorrados (estimado)";
+        return out.str();
+    }
+
+private:
+    struct Calentado {
+        size_t bytes = 0;       // Bytes dejados en caché
+        double msEnFrio = 0;    // Lo que tardó el primer bloque (lo que habría esperado ffplay)
+        bool completa = false;  // Se llegó al final sin ser cancelada
+    };
+
+    mutex mtx;
+    condition_variable cv;
+    vector<string> ventana;
+    unsigned long generacion = 0;
+    bool salir = false;
+    unordered_map<string, Calentado> calientes;
+    int inicios = 0;
+    int aciertos = 0;
+    double msAhorrados = 0;
+    thread hilo; // Debe ser el último miembro: arranca en el constructor
+
+    // Lee el archivo hasta 'limite' bytes; false si la generación cambió
+    bool calentar(const string& ruta, size_t limite, unsigned long gen, vector<char>& buffer, Calentado& res) {
+        int fd = open(ruta.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return true; // Un archivo que falta no cancela el resto
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            return true;
+        }
+        size_t total = min((size_t)st.st_size, limite);
+        posix_fadvise(fd, 0, total, POSIX_FADV_WILLNEED);
+
+        auto inicio = chrono::steady_clock::now();
+        size_t leidos = 0;
+        bool cancelada = false;
+        while (leidos < total) {
+            {
+                lock_guard<mutex> lk(mtx);
+                if (gen != generacion) { cancelada = true; break; }
+            }
+            ssize_t n = pread(fd, buffer.data(), min(buffer.size(), total - leidos), leidos);
+            if (n <= 0) break;
+            if (leidos == 0) {
+                res.msEnFrio = chrono::duration<double, milli>(chrono::steady_clock::now() - inicio).count();
+            }
+            leidos += n;
+        }
+        close(fd);
+        res.bytes = leidos;
+        res.completa = !cancelada;
+        return !cancelada;
+    }
+
+    void trabajar() {
+        vector<char> buffer(PRELECTURA_BLOQUE);
+        unsigned long hecha = 0;
+        while (true) {
+            vector<string> rutas;
+            unsigned long gen;
+            {
+                unique_lock<mutex> lk(mtx);
+                cv.wait(lk, [&]{ return salir || generacion != hecha; });
+                if (salir) return;
+                rutas = ventana;
+                gen = generacion;
+
+                // Olvidar lo que ya no está en la ventana
+                for (auto it = calientes.begin(); it != calientes.end(); ) {
+                    if (find(rutas.begin(), rutas.end(), it->first) == rutas.end()) it = calientes.erase(it);
+                    else ++it;
+                }
+            }
+
+            size_t presupuesto = PRELECTURA_MAX_BYTES;
+            bool cancelada = false;
+            for (const string& ruta : rutas) {
+                {
+                    lock_guard<mutex> lk(mtx);
+                    auto it = calientes.find(ruta);
+                    if (it != calientes.end() && it->second.completa) {
+                        presupuesto -= min(presupuesto, it->second.bytes);
+                        continue;
+                    }
+                }
+                if (presupuesto == 0) break;
+                Calentado res;
+                cancelada = !calentar(ruta, presupuesto, gen, buffer, res);
+                presupuesto -= min(presupuesto, res.bytes);
+                {
+                    lock_guard<mutex> lk(mtx);
+                    if (!cancelada) calientes[ruta] = res;
+                }
+                if (cancelada) break;
+            }
+            hecha = gen;
+        }
+    }
+};
+
+// --- Similitud entre canciones ---
+//
+// Cada canción analizada se resume en 16 características: tempo, volumen y su
+// variación, centroide espectral, cruces por cero, densidad de ataques,
+// planitud del espectro y su forma en 8 bandas (el timbre). El análisis se hace
+// aparte, con --analyze, y queda en caracteristicas.bin. Al cargarlo, cada
+// característica se normaliza sobre toda la biblioteca y se cuantiza a un byte:
+// 16 bytes por canción, que se recorren por fuerza bruta con SSE2.
+
+const char MAGIA_CARACTERISTICAS[8] = {'S', 'P', 'C', 'A', 'R', 'A', '0', '1'};
+
+enum Caracteristica {
+    CAR_TEMPO,               // Pulsos por minuto
+    CAR_VOLUMEN,             // dB RMS promedio
+    CAR_DINAMICA,            // Desviación del volumen
+    CAR_CENTROIDE,           // log2 del centroide espectral en Hz
+    CAR_VARIACION_CENTROIDE,
+    CAR_CRUCES,              // Cruces por cero por muestra
+    CAR_ATAQUES,             // Flujo espectral promedio
+    CAR_PLANITUD,            // 0 = tonal, 1 = ruido
+    CAR_BANDA0,              // Energía relativa por banda, de graves a agudos
+    NUM_CARACTERISTICAS = CAR_BANDA0 + 8
+};
+
+// Cuánto pesa cada característica en la distancia
+const float PESOS_CARACTERISTICAS[NUM_CARACTERISTICAS] = {
+    2.0f, 1.5f, 1.0f, 1.5f, 1.0f, 1.0f, 1.0f, 1.0f,
+    0.75f, 0.75f, 0.75f, 0.75f, 0.75f, 0.75f, 0.75f, 0.75f
+};
+const float ESCALA_CUANTIZACION = 20.0f;  // Desviaciones estándar -> unidades de int8
+
+struct RegistroCaracteristicas {
+    uint64_t pista;       // idPista() de la canción
+    int64_t tamano;       // Tamaño y fecha del archivo al analizarlo
+    int64_t mtime;
+    float valores[NUM_CARACTERISTICAS];
+};
+static_assert(sizeof(RegistroCaracteristicas) == 88, "RegistroCaracteristicas debe medir 88 bytes");
+
+const int ANALISIS_FRECUENCIA = 11025;   // Mono; basta para ritmo y timbre
+const size_t ANALISIS_VENTANA = 512;     // Muestras por FFT
+const size_t ANALISIS_SALTO = 256;       // ~43 tramas por segundo
+const int ANALISIS_BANDAS = NUM_CARACTERISTICAS - CAR_BANDA0;
+const double UMBRAL_SILENCIO = 1e-4;     // RMS bajo el cual la trama no cuenta
+
+// Acumula estadísticas trama a trama mientras llega el audio
+class AnalizadorAudio {
+public:
+    AnalizadorAudio()
+        : ventana(ANALISIS_VENTANA), invertidos(ANALISIS_VENTANA),
+          cosenos(ANALISIS_VENTANA / 2), senos(ANALISIS_VENTANA / 2),
+          re(ANALISIS_VENTANA), im(ANALISIS_VENTANA), previa(ANALISIS_VENTANA / 2 + 1, 0.0f) {
+        const size_t n = ANALISIS_VENTANA;
+        int bits = 0;
+        while (((size_t)1 << bits) < n) bits++;
+        for (size_t i = 0; i < n; ++i) {
+            ventana[i] = (float)(0.5 - 0.5 * cos(2 * M_PI * i / n));
+            size_t r = 0;
+            for (int b = 0; b < bits; ++b) {
+                if (i & ((size_t)1 << b)) r |= (size_t)1 << (bits - 1 - b);
+            }
+            invertidos[i] = r;
+        }
+        for (size_t k = 0; k < n / 2; ++k) {
+            cosenos[k] = (float)cos(2 * M_PI * k / n);
+            senos[k] = (float)-sin(2 * M_PI * k / n);
+        }
+        // Bandas logarítmicas de 60 Hz a 5 kHz
+        for (int b = 0; b <= ANALISIS_BANDAS; ++b) {
+            double f = 60.0 * pow(5000.0 / 60.0, (double)b / ANALISIS_BANDAS);
+            limites[b] = max<size_t>(1, (size_t)lrint(f * n / ANALISIS_FRECUENCIA));
+            if (b > 0) limites[b] = max(limites[b], limites[b - 1] + 1);
+        }
+    }
+
+    void agregar(const float* muestras, size_t n) {
+        pendientes.insert(pendientes.end(), muestras, muestras + n);
+        size_t inicio = 0;
+        while (pendientes.size() - inicio >= ANALISIS_VENTANA) {
+            procesarTrama(&pendientes[inicio]);
+            inicio += ANALISIS_SALTO;
+        }
+        pendientes.erase(pendientes.begin(), pendientes.begin() + inicio);
+    }
+
+    // false si no hubo audio con sonido
+    bool resultado(float valores[NUM_CARACTERISTICAS]) const {
+        if (tramas == 0) return false;
+        auto media = [&](double s) { return s / tramas; };
+        auto desviacion = [&](double s, double s2) { return sqrt(max(0.0, s2 / tramas - media(s) * media(s))); };
+        valores[CAR_TEMPO] = (float)estimarTempo();
+        valores[CAR_VOLUMEN] = (float)media(sumaDb);
+        valores[CAR_DINAMICA] = (float)desviacion(sumaDb, sumaDb2);
+        valores[CAR_CENTROIDE] = (float)media(sumaCentroide);
+        valores[CAR_VARIACION_CENTROIDE] = (float)desviacion(sumaCentroide, sumaCentroide2);
+        valores[CAR_CRUCES] = (float)media(sumaCruces);
+        valores[CAR_ATAQUES] = (float)media(sumaFlujo);
+        valores[CAR_PLANITUD] = (float)media(sumaPlanitud);
+        // Forma del espectro: energía de cada banda respecto al promedio de todas
+        double promedio = 0;
+        for (int b = 0; b < ANALISIS_BANDAS; ++b) promedio += media(sumaBandas[b]) / ANALISIS_BANDAS;
+        for (int b = 0; b < ANALISIS_BANDAS; ++b) valores[CAR_BANDA0 + b] = (float)(media(sumaBandas[b]) - promedio);
+        return true;
+    }
+
+private:
+    vector<float> ventana;
+    vector<size_t> invertidos;   // Permutación de bits invertidos de la FFT
+    vector<float> cosenos, senos;
+    vector<float> re, im;
+    vector<float> previa;        // Espectro logarítmico de la trama anterior
+    size_t limites[ANALISIS_BANDAS + 1];
+    vector<float> pendientes;
+
+    size_t tramas = 0;
+    double sumaDb = 0, sumaDb2 = 0;
+    double sumaCentroide = 0, sumaCentroide2 = 0;
+    double sumaCruces = 0, sumaFlujo = 0, sumaPlanitud = 0;
+    double sumaBandas[ANALISIS_BANDAS] = {};
+    vector<float> ataques;       // Envolvente de ataques, una entrada por trama
+
+    // FFT radix 2 sobre re/im, ya en orden de bits invertidos
+    void fft() {
+        const size_t n = ANALISIS_VENTANA;
+        for (size_t largo = 2; largo <= n; largo <<= 1) {
+            size_t medio = largo / 2, paso = n / largo;
+            for (size_t i = 0; i < n; i += largo) {
+                for (size_t j = 0; j < medio; ++j) {
+                    float c = cosenos[j * paso], s = senos[j * paso];
+                    size_t a = i + j, b = a + medio;
+                    float tr = c * re[b] - s * im[b];
+                    float ti = c * im[b] + s * re[b];
+                    re[b] = re[a] - tr;
+                    im[b] = im[a] - ti;
+                    re[a] += tr;
+                    im[a] += ti;
+                }
+            }
+        }
+    }
+
+    void procesarTrama(const float* x) {
+        const size_t n = ANALISIS_VENTANA, mitad = n / 2;
+        double energia = 0;
+        size_t cruces = 0;
+        for (size_t i = 0; i < n; ++i) {
+            energia += (double)x[i] * x[i];
+            if (i > 0 && ((x[i] >= 0) != (x[i - 1] >= 0))) cruces++;
+        }
+        double rms = sqrt(energia / n);
+        if (rms < UMBRAL_SILENCIO) {
+            ataques.push_back(0);
+            return;
+        }
+
+        for (size_t i = 0; i < n; ++i) {
+            re[invertidos[i]] = x[i] * ventana[i];
+            im[invertidos[i]] = 0;
+        }
+        fft();
+
+        // Magnitudes escaladas para que un seno a fondo de escala valga ~1
+        double sumaM = 0, sumaFM = 0, sumaLog = 0, flujo = 0;
+        double bandas[ANALISIS_BANDAS] = {};
+        int banda = 0;
+        for (size_t k = 1; k <= mitad; ++k) {
+            float m = sqrt(re[k] * re[k] + im[k] * im[k]) * 4.0f / n;
+            sumaM += m;
+            sumaFM += m * k;
+            sumaLog += log(m + 1e-10);
+            while (banda < ANALISIS_BANDAS && k >= limites[banda + 1]) banda++;
+            if (banda < ANALISIS_BANDAS && k >= limites[banda]) bandas[banda] += (double)m * m;
+            float l = log1p(100.0f * m);
+            flujo += max(0.0f, l - previa[k]);
+            previa[k] = l;
+        }
+
+        double db = 20 * log10(rms);
+        double centroide = log2(max(1.0, sumaFM / max(sumaM, 1e-12) * ANALISIS_FRECUENCIA / n));
+        tramas++;
+        sumaDb += db;
+        sumaDb2 += db * db;
+        sumaCentroide += centroide;
+        sumaCentroide2 += centroide * centroide;
+        sumaCruces += (double)cruces / n;
+        sumaFlujo += flujo / mitad;
+        sumaPlanitud += exp(sumaLog / mitad) / (sumaM / mitad + 1e-10);
+        for (int b = 0; b < ANALISIS_BANDAS; ++b) sumaBandas[b] += log10(bandas[b] + 1e-10);
+        ataques.push_back((float)(flujo / mitad));
+    }
+
+    // Autocorrelación de la envolvente de ataques entre 50 y 200 BPM,
+    // favoreciendo los tempos cercanos a 120 para evitar saltos de octava
+    double estimarTempo() const {
+        const double tps = (double)ANALISIS_FRECUENCIA / ANALISIS_SALTO;
+        const size_t minimo = (size_t)(tps * 60 / 200), maximo = (size_t)(tps * 60 / 50) + 1;
+        if (ataques.size() < maximo * 4) return 120;
+        double promedio = 0;
+        for (float a : ataques) promedio += a;
+        promedio /= ataques.size();
+        // Suavizar ensancha los picos: un período que cae entre dos tramas no se pierde
+        vector<double> e(ataques.size());
+        for (size_t i = 0; i < e.size(); ++i) {
+            double izquierda = ataques[i > 0 ? i - 1 : i], derecha = ataques[i + 1 < e.size() ? i + 1 : i];
+            e[i] = (izquierda + 2.0 * ataques[i] + derecha) / 4 - promedio;
+        }
+
+        vector<double> ac(maximo + 2, 0);
+        for (size_t lag = minimo - 1; lag <= maximo + 1; ++lag) {
+            double s = 0;
+            for (size_t i = 0; i + lag < e.size(); ++i) s += e[i] * e[i + lag];
+            ac[lag] = s / (e.size() - lag);
+        }
+        size_t mejor = 0;
+        double mejorValor = -1e300;
+        for (size_t lag = minimo; lag <= maximo; ++lag) {
+            double bpm = 60 * tps / lag;
+            double peso = exp(-0.5 * pow(log2(bpm / 120), 2));
+            if (ac[lag] * peso > mejorValor) {
+                mejorValor = ac[lag] * peso;
+                mejor = lag;
+            }
+        }
+        if (mejorValor <= 0) return 120;
+        // Interpolación parabólica alrededor del máximo
+        double a = ac[mejor - 1], b = ac[mejor], c = ac[mejor + 1];
+        double denominador = a - 2 * b + c;
+        double desplazamiento = denominador < 0 ? 0.5 * (a - c) / denominador : 0;
+        return 60 * tps / (mejor + desplazamiento);
+    }
+};
+
+// Decodifica el archivo a mono y calcula sus características
+bool analizarArchivo(const string& ruta, float valores[NUM_CARACTERISTICAS]) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) return false;
+    pid_t pid = lanzarProceso({"ffmpeg", "-nostdin", "-v", "quiet", "-i", ruta, "-vn",
+                               "-f", "f32le", "-ac", "1", "-ar", to_string(ANALISIS_FRECUENCIA), "pipe:1"},
+                              -1, fds[1]);
+    close(fds[1]);
+    AnalizadorAudio analizador;
+    vector<float> bloque(16384);
+    size_t sobrante = 0;  // Bytes de una muestra partida entre dos lecturas
+    char* base = reinterpret_cast<char*>(bloque.data());
+    while (true) {
+        ssize_t n = read(fds[0], base + sobrante, bloque.size() * sizeof(float) - sobrante);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        size_t bytes = sobrante + n;
+        analizador.agregar(bloque.data(), bytes / sizeof(float));
+        sobrante = bytes % sizeof(float);
+        memmove(base, base + bytes - sobrante, sobrante);
+    }
+    close(fds[0]);
+    int estado = 0;
+    waitpid(pid, &estado, 0);
+    if (!WIFEXITED(estado) || WEXITSTATUS(estado) != 0) return false;
+    return analizador.resultado(valores);
+}
+
+// Bibliotecas grandes se agrupan con k-means en listas de pistas parecidas
+// (índice invertido): una búsqueda solo recorre las listas cuyos centros
+// quedan más cerca de la consulta. Con pocas canciones se recorren todas.
+const size_t IVF_MIN_PISTAS = 20000;   // Por debajo, búsqueda exhaustiva
+const size_t IVF_LISTAS = 256;
+const size_t IVF_SONDEOS = 16;         // Listas recorridas por búsqueda
+const size_t IVF_MUESTRA = 64;         // Pistas de entrenamiento por lista
+const int IVF_ITERACIONES = 8;
+
+class IndiceSimilitud {
+public:
+    static vector<RegistroCaracteristicas> leerRegistros(const string& ruta) {
+        vector<RegistroCaracteristicas> registros;
+        ifstream f(ruta, ios::binary);
+        if (!f.is_open()) return registros;
+        char magia[sizeof(MAGIA_CARACTERISTICAS)];
+        if (!f.read(magia, sizeof(magia)) || memcmp(magia, MAGIA_CARACTERISTICAS, sizeof(magia)) != 0) return registros;
+        f.seekg(0, ios::end);
+        size_t total = ((size_t)f.tellg() - sizeof(magia)) / sizeof(RegistroCaracteristicas);
+        f.seekg(sizeof(magia));
+        registros.resize(total);
+        f.read(reinterpret_cast<char*>(registros.data()), total * sizeof(RegistroCaracteristicas));
+        return registros;
+    }
+
+    // Escribe a un temporal y lo renombra: un lector nunca ve el archivo a medias
+    static bool guardarRegistros(const string& ruta, const vector<RegistroCaracteristicas>& registros) {
+        string temporal = ruta + ".tmp";
+        {
+            ofstream f(temporal, ios::binary | ios::trunc);
+            if (!f.is_open()) return false;
+            f.write(MAGIA_CARACTERISTICAS, sizeof(MAGIA_CARACTERISTICAS));
+            f.write(reinterpret_cast<const char*>(registros.data()), registros.size() * sizeof(RegistroCaracteristicas));
+            if (!f.good()) return false;
+        }
+        return rename(temporal.c_str(), ruta.c_str()) == 0;
+    }
+
+    bool cargar(const string& ruta) {
+        construir(leerRegistros(ruta));
+        return !pistas.empty();
+    }
+
+    // Normaliza cada característica sobre toda la biblioteca, cuantiza a int8
+    // y, si hay suficientes pistas, arma las listas
+    void construir(const vector<RegistroCaracteristicas>& registros) {
+        const size_t n = registros.size();
+        double media[NUM_CARACTERISTICAS] = {}, desviacion[NUM_CARACTERISTICAS] = {};
+        for (const RegistroCaracteristicas& r : registros) {
+            for (int d = 0; d < NUM_CARACTERISTICAS; ++d) {
+                media[d] += r.valores[d];
+                desviacion[d] += (double)r.valores[d] * r.valores[d];
+            }
+        }
+        float escala[NUM_CARACTERISTICAS];
+        for (int d = 0; d < NUM_CARACTERISTICAS; ++d) {
+            media[d] /= max<size_t>(n, 1);
+            desviacion[d] = sqrt(max(0.0, desviacion[d] / max<size_t>(n, 1) - media[d] * media[d]));
+            escala[d] = ESCALA_CUANTIZACION * PESOS_CARACTERISTICAS[d] / (desviacion[d] > 1e-9 ? desviacion[d] : 1.0);
+        }
+        pistas.resize(n);
+        vectores.resize(n * NUM_CARACTERISTICAS);
+        for (size_t i = 0; i < n; ++i) {
+            pistas[i] = registros[i].pista;
+            for (int d = 0; d < NUM_CARACTERISTICAS; ++d) {
+                long q = lrint((registros[i].valores[d] - media[d]) * escala[d]);
+                vectores[i * NUM_CARACTERISTICAS + d] = (int8_t)max(-127L, min(127L, q));
+            }
+        }
+        agrupar();
+        filas.clear();
+        filas.reserve(n);
+        for (size_t i = 0; i < n; ++i) filas.emplace(pistas[i], (uint32_t)i);
+    }
+
+    size_t tamano() const { return pistas.size(); }
+    size_t listas() const { return centros.size() / NUM_CARACTERISTICAS; }
+
+    // Las k pistas más cercanas al promedio de 'recientes' (las últimas pesan
+    // más), sin repetir ninguna de 'excluir'
+    vector<uint64_t> vecinos(const vector<uint64_t>& recientes, const unordered_set<uint64_t>& excluir, size_t k,
+                             size_t sondeos = IVF_SONDEOS) const {
+        int suma[NUM_CARACTERISTICAS] = {};
+        int pesoTotal = 0;
+        for (size_t i = 0; i < recientes.size(); ++i) {
+            auto it = filas.find(recientes[i]);
+            if (it == filas.end()) continue;
+            int peso = (int)i + 1;
+            for (int d = 0; d < NUM_CARACTERISTICAS; ++d) suma[d] += peso * vectores[(size_t)it->second * NUM_CARACTERISTICAS + d];
+            pesoTotal += peso;
+        }
+        if (pesoTotal == 0 || k == 0) return {};
+        alignas(16) int8_t consulta[NUM_CARACTERISTICAS];
+        for (int d = 0; d < NUM_CARACTERISTICAS; ++d) consulta[d] = (int8_t)lrint((double)suma[d] / pesoTotal);
+
+        vector<uint64_t> res;
+        for (uint32_t fila : buscar(consulta, excluir, k, sondeos)) res.push_back(pistas[fila]);
+        return res;
+    }
+
+    // Filas de las k pistas más cercanas, de la más a la menos parecida,
+    // recorriendo las 'sondeos' listas más prometedoras (0 = todas)
+    vector<uint32_t> buscar(const int8_t* consulta, const unordered_set<uint64_t>& excluir, size_t k, size_t sondeos) const {
+        Mejores mejores(k, &excluir, &pistas);
+        if (sondeos == 0 || listas() == 0) {
+            recorrer(vectores.data(), 0, pistas.size(), consulta, mejores);
+            return mejores.filas();
+        }
+        Mejores cercanas(min(sondeos, listas()), nullptr, nullptr);
+        recorrer(centros.data(), 0, listas(), consulta, cercanas);
+        for (uint32_t lista : cercanas.filas()) {
+            recorrer(vectores.data(), inicioLista[lista], inicioLista[lista + 1], consulta, mejores);
+        }
+        return mejores.filas();
+    }
+
+private:
+    // Las k menores distancias vistas hasta ahora, ordenadas
+    struct Mejores {
+        size_t k;
+        const unordered_set<uint64_t>* excluir;  // Pistas que no pueden entrar, o nullptr
+        const vector<uint64_t>* pistas;
+        vector<pair<int32_t, uint32_t>> lista;
+        int32_t umbral = INT32_MAX;   // Distancia a superar para entrar
+
+        Mejores(size_t k, const unordered_set<uint64_t>* excluir, const vector<uint64_t>* pistas)
+            : k(k), excluir(excluir), pistas(pistas) {}
+
+        void considerar(int32_t d, uint32_t fila) {
+            if (d >= umbral || (excluir && excluir->count((*pistas)[fila]))) return;
+            lista.insert(upper_bound(lista.begin(), lista.end(), make_pair(d, fila)), {d, fila});
+            if (lista.size() > k) lista.pop_back();
+            if (lista.size() == k) umbral = lista.back().first;
+        }
+
+        vector<uint32_t> filas() const {
+            vector<uint32_t> res;
+            for (auto& par : lista) res.push_back(par.second);
+            return res;
+        }
+    };
+
+    vector<uint64_t> pistas;                  // Fila -> ID de pista, agrupadas por lista
+    vector<int8_t> vectores;                  // NUM_CARACTERISTICAS bytes por fila
+    unordered_map<uint64_t, uint32_t> filas;  // ID de pista -> fila
+    vector<int8_t> centros;                   // Centro de cada lista
+    vector<size_t> inicioLista;               // Primera fila de cada lista; una entrada extra al final
+
+    static int32_t distancia(const int8_t* a, const int8_t* b) {
+        int32_t d = 0;
+        for (int j = 0; j < NUM_CARACTERISTICAS; ++j) d += (a[j] - b[j]) * (a[j] - b[j]);
+        return d;
+    }
+
+    // Compara la consulta con cada fila en [desde, hasta) de 'datos'
+    static void recorrer(const int8_t* datos, size_t desde, size_t hasta, const int8_t* consulta, Mejores& mejores) {
+        size_t i = desde;
+#if defined(__SSE2__)
+        // Cuatro filas por vuelta; solo las que superan al peor de los mejores
+        // salen del registro SIMD
+        static_assert(NUM_CARACTERISTICAS == 16, "recorrer asume 16 bytes por fila");
+        const __m128i q = _mm_loadu_si128(reinterpret_cast<const __m128i*>(consulta));
+        const __m128i qBajo = _mm_srai_epi16(_mm_unpacklo_epi8(q, q), 8);
+        const __m128i qAlto = _mm_srai_epi16(_mm_unpackhi_epi8(q, q), 8);
+        // Cuadrados de las diferencias de una fila, en cuatro sumas parciales
+        auto parcial = [&](const int8_t* p) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            __m128i bajo = _mm_sub_epi16(_mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8), qBajo);
+            __m128i alto = _mm_sub_epi16(_mm_srai_epi16(_mm_unpackhi_epi8(v, v), 8), qAlto);
+            return _mm_add_epi32(_mm_madd_epi16(bajo, bajo), _mm_madd_epi16(alto, alto));
+        };
+        for (; i + 4 <= hasta; i += 4) {
+            const int8_t* p = datos + i * NUM_CARACTERISTICAS;
+            __m128i a = parcial(p), b = parcial(p + 16), c = parcial(p + 32), d = parcial(p + 48);
+            __m128i ab = _mm_add_epi32(_mm_unpacklo_epi32(a, b), _mm_unpackhi_epi32(a, b));
+            __m128i cd = _mm_add_epi32(_mm_unpacklo_epi32(c, d), _mm_unpackhi_epi32(c, d));
+            __m128i suma = _mm_add_epi32(_mm_unpacklo_epi64(ab, cd), _mm_unpackhi_epi64(ab, cd));
+            int mascara = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(suma, _mm_set1_epi32(mejores.umbral))));
+            if (mascara) {
+                alignas(16) int32_t distancias[4];
+                _mm_store_si128(reinterpret_cast<__m128i*>(distancias), suma);
+                for (int j = 0; j < 4; ++j) {
+                    if (mascara & (1 << j)) mejores.considerar(distancias[j], (uint32_t)(i + j));
+                }
+            }
+        }
+#endif
+        for (; i < hasta; ++i) mejores.considerar(distancia(datos + i * NUM_CARACTERISTICAS, consulta), (uint32_t)i);
+    }
+
+    // k-means sobre una muestra y reordenamiento de las filas por lista
+    void agrupar() {
+        centros.clear();
+        inicioLista.clear();
+        const size_t n = pistas.size();
+        if (n < IVF_MIN_PISTAS) return;
+        const size_t k = IVF_LISTAS;
+        const size_t paso = max<size_t>(1, n / (k * IVF_MUESTRA));
+
+        auto masCercano = [&](const int8_t* v) {
+            Mejores m(1, nullptr, nullptr);
+            recorrer(centros.data(), 0, k, v, m);
+            return m.lista[0].second;
+        };
+
+        centros.resize(k * NUM_CARACTERISTICAS);
+        for (size_t c = 0; c < k; ++c) {
+            memcpy(&centros[c * NUM_CARACTERISTICAS], &vectores[(c * (n / k)) * NUM_CARACTERISTICAS], NUM_CARACTERISTICAS);
+        }
+        for (int iteracion = 0; iteracion < IVF_ITERACIONES; ++iteracion) {
+            vector<int64_t> sumas(k * NUM_CARACTERISTICAS, 0);
+            vector<size_t> cuentas(k, 0);
+            for (size_t i = 0; i < n; i += paso) {
+                const int8_t* v = &vectores[i * NUM_CARACTERISTICAS];
+                uint32_t c = masCercano(v);
+                cuentas[c]++;
+                for (int d = 0; d < NUM_CARACTERISTICAS; ++d) sumas[c * NUM_CARACTERISTICAS + d] += v[d];
+            }
+            for (size_t c = 0; c < k; ++c) {
+                if (cuentas[c] == 0) continue;  // Lista vacía: conserva su centro
+                for (int d = 0; d < NUM_CARACTERISTICAS; ++d) {
+                    centros[c * NUM_CARACTERISTICAS + d] = (int8_t)lrint((double)sumas[c * NUM_CARACTERISTICAS + d] / cuentas[c]);
+                }
+            }
+        }
+
+        // Asignar todas las filas y dejarlas contiguas por lista
+        vector<uint32_t> asignacion(n);
+        inicioLista.assign(k + 1, 0);
+        for (size_t i = 0; i < n; ++i) {
+            asignacion[i] = masCercano(&vectores[i * NUM_CARACTERISTICAS]);
+            inicioLista[asignacion[i] + 1]++;
+        }
+        for (size_t c = 0; c < k; ++c) inicioLista[c + 1] += inicioLista[c];
+        vector<size_t> destino(inicioLista.begin(), inicioLista.end() - 1);
+        vector<uint64_t> pistasOrdenadas(n);
+        vector<int8_t> vectoresOrdenados(n * NUM_CARACTERISTICAS);
+        for (size_t i = 0; i < n; ++i) {
+            size_t j = destino[asignacion[i]]++;
+            pistasOrdenadas[j] = pistas[i];
+            memcpy(&vectoresOrdenados[j * NUM_CARACTERISTICAS], &vectores[i * NUM_CARACTERISTICAS], NUM_CARACTERISTICAS);
+        }
+        pistas = move(pistasOrdenadas);
+        vectores = move(vectoresOrdenados);
+    }
+};
+
+// Busca en segundo plano canciones parecidas a las últimas escuchadas, para
+// que el reproductor siga cuando se acaba la playlist. El índice se carga la
+// primera vez que se necesita.
+const size_t AUTOCOLA_RESTANTES = 1;   // Pedir más cuando quede esta cantidad o menos
+const size_t AUTOCOLA_CANCIONES = 5;   // Canciones agregadas por pedido
+const size_t AUTOCOLA_HISTORIA = 5;    // Últimas canciones que forman la consulta
+
+class ColaSimilares {
+public:
+    ColaSimilares(const string& rutaIndice, const string& rutaCanciones)
+        : rutaIndice(rutaIndice), rutaCanciones(rutaCanciones) {}
+
+    ~ColaSimilares() {
+        if (pendiente.valid()) pendiente.wait();
+    }
+
+    void pedir(vector<uint64_t> recientes, unordered_set<uint64_t> excluir) {
+        if (pendiente.valid()) return;
+        pendiente = async(launch::async, [this, recientes = move(recientes), excluir = move(excluir)]() {
+            return buscar(recientes, excluir);
+        });
+    }
+
+    bool pidiendo() const { return pendiente.valid(); }
+
+    bool lista() const {
+        return pendiente.valid() && pendiente.wait_for(chrono::seconds(0)) == future_status::ready;
+    }
+
+    // Espera si la búsqueda no ha terminado
+    vector<Cancion> recoger() { return pendiente.valid() ? pendiente.get() : vector<Cancion>(); }
+
+private:
+    string rutaIndice;
+    string rutaCanciones;
+    IndiceSimilitud indice;
+    bool indiceCargado = false;
+    future<vector<Cancion>> pendiente;
+
+    vector<Cancion> buscar(const vector<uint64_t>& recientes, const unordered_set<uint64_t>& excluir) {
+        if (!indiceCargado) {
+            indice.cargar(rutaIndice);
+            indiceCargado = true;
+        }
+        vector<uint64_t> ids = indice.vecinos(recientes, excluir, AUTOCOLA_CANCIONES);
+        if (ids.empty()) return {};
+
+        // Recuperar los datos de cada canción; se deja de leer al tenerlas todas
+        unordered_map<uint64_t, size_t> posicion;
+        for (size_t i = 0; i < ids.size(); ++i) posicion[ids[i]] = i;
+        vector<Cancion> encontradas(ids.size());
+        vector<bool> hallada(ids.size(), false);
+        size_t faltan = ids.size();
+        recorrerCanciones(rutaCanciones, [&](size_t, Cancion& c) {
+            auto it = posicion.find(idPista(c));
+            if (it != posicion.end() && !hallada[it->second]) {
+                hallada[it->second] = true;
+                encontradas[it->second] = move(c);
+                faltan--;
+            }
+            return faltan > 0;
+        });
+        vector<Cancion> res;
+        for (size_t i = 0; i < ids.size(); ++i) {
+            if (hallada[i]) res.push_back(move(encontradas[i]));
+        }
+        return res;
+    }
+};
+
+// --- Modo reproductor interactivo ---
+
+void mostrarVistaReproductor(Playlist& pl, bool shuffle, int idx, NodoCancion* nodo, const string& estado) {
+    limpiarPantalla();
+    cout << "=== SIMPLE PLAYER ===" << endl;
+    cout << "Tu playlist actual contiene " << pl.contar() << " canciones," << endl;
+    cout << "con un total de " << (int)pl.duracionTotal() << " minutos de música." << endl;
+    cout << "------------------------------------------" << endl;
+    cout << "Canción actual: " << idx << endl;
+    cout << "Título: " << nodo->cancion.titulo << endl;
+    cout << "Artista: " << nodo->cancion.artista << endl;
+    int min = (int)nodo->cancion.duracion_minutos;
+    int seg = (int)((nodo->cancion.duracion_minutos - min) * 60);
+    cout << "Duración: 0h " << min << "m " << seg << "s" << endl;
+    cout << estado << endl;
+    // Línea de tiempo actual
+    cout << "Tiempo actual: 0h 0m 0s" << endl;
+    cout << "------------------------------------------" << endl;
+    cout << "Presiona un comando en cualquier momento:" << endl;
+    cout << endl;
+    cout << "[R] = Reproducir    | [P] = Pausar" << endl;
+    cout << "[S] = Siguiente     | [A] = Anterior" << endl;
+    cout << "[F] = Avance rápido | [B] = Retroceso" << endl;
+    cout << "[+] = Más rápido    | [-] = Más lento" << endl;
+    cout << "[M] = Modo aleatorio [" << (shuffle ? "On" : "Off") << "]" << endl;
+    cout << "[Q] = Detener" << endl;
+    cout << "------------------------------------------" << endl;
+}
+
+void modoReproductor(Playlist& pl, HistorialReproduccion& historial, ColaSimilares* similares = nullptr) {
+    if (pl.contar() == 0) {
+        cout << "Tu playlist está vacía." << endl;
+        pausa();
+        return;
+    }
+    bool shuffle = false;
+    // Canciones de la cola automática: solo viven en esta sesión, la playlist
+    // guardada no las recibe (deque: los punteros no cambian al crecer)
+    deque<NodoCancion> agregadas;
+    auto nodosSesion = [&]() {
+        vector<NodoCancion*> nodos = pl.nodosVector();
+        for (NodoCancion& n : agregadas) nodos.push_back(&n);
+        return nodos;
+    };
+    // Orden real de reproducción: la playlist tal cual o mezclada, seguida de
+    // las canciones agregadas. El controlador tiene las mismas en el mismo orden.
+    vector<NodoCancion*> orden = nodosSesion();
+    NodoCancion* nodo = pl.actual ? pl.actual : pl.cabeza;
+    size_t posicion = find(orden.begin(), orden.end(), nodo) - orden.begin();
+
+    auto cancionesDe = [](const vector<NodoCancion*>& nodos) {
+        vector<Cancion> canciones;
+        canciones.reserve(nodos.size());
+        for (NodoCancion* n : nodos) canciones.push_back(n->cancion);
+        return canciones;
+    };
+
+    // Rehace el orden; la canción actual queda en su lugar dentro del nuevo
+    auto recalcularOrden = [&]() {
+        orden = nodosSesion();
+        if (shuffle) {
+            random_device rd;
+            mt19937 g(rd());
+            std::shuffle(orden.begin(), orden.end(), g);
+        }
+        posicion = find(orden.begin(), orden.end(), nodo) - orden.begin();
+    };
+
+    // Una canción que se deja antes de terminar cuenta como saltada
+    SalidaTuberia salida;
+    PlayerController controlador(salida, [&](const Cancion& c, TipoEvento tipo, int segundos) {
+        historial.registrar(c, tipo, segundos);
+    });
+
+    // Próximas canciones según el orden real de reproducción
+    Precargador precargador;
+    NodoCancion* nodoPrelectura = nullptr;
+    bool shufflePrelectura = shuffle;
+    auto proximasRutas = [&]() {
+        vector<string> rutas;
+        for (size_t i = posicion + 1; i < orden.size() && (int)rutas.size() < PRELECTURA_CANCIONES; ++i) {
+            rutas.push_back(orden[i]->cancion.ruta());
+        }
+        return rutas;
+    };
+
+    // Cola automática: al acabarse la playlist sigue con canciones parecidas
+    // a las últimas escuchadas
+    vector<uint64_t> recientes;
+    bool colaExtendida = false;
+    auto restantes = [&]() -> size_t { return orden.size() - 1 - posicion; };
+    // Espera la búsqueda en curso, si la hay, y agrega lo encontrado a la cola
+    auto extenderCola = [&]() {
+        if (!similares || !similares->pidiendo()) return;
+        vector<Cancion> nuevas = similares->recoger();
+        for (const Cancion& c : nuevas) {
+            agregadas.emplace_back(c);
+            orden.push_back(&agregadas.back());
+        }
+        if (!nuevas.empty()) controlador.agregarACola(nuevas);
+        colaExtendida = !nuevas.empty();
+    };
+
+    // Reproducir automáticamente al entrar
+    controlador.establecerCola(cancionesDe(orden), posicion, true);
+    controlador.sincronizar();
+
+    uint64_t finAvisado = 0; // Canción con la que ya se avisó el fin de la playlist
+    bool salir = false;
+    while (!salir) {
+        if (similares && similares->lista()) extenderCola();
+
+        InstantaneaReproductor e = controlador.estado();
+        posicion = min(e.posicion, orden.size() - 1);
+        nodo = orden[posicion];
+        // Sin mezclar, las primeras posiciones son las de la playlist
+        if (!shuffle && posicion < (size_t)pl.contar()) pl.actual = nodo;
+
+        // La última canción terminó sola
+        if (e.colaTerminada && e.pistasIniciadas != finAvisado) {
+            finAvisado = e.pistasIniciadas;
+            // Si la búsqueda de parecidas sigue en curso, esperarla y continuar
+            extenderCola();
+            if (restantes() > 0) {
+                controlador.saltar(1);
+                controlador.sincronizar();
+                continue;
+            }
+            cout << (shuffle ? "\rFin de la playlist aleatoria." : "\rFin de la playlist.") << endl;
+            pausa();
+        }
+
+        // Si cambió la canción o el orden, actualizar la ventana de prelectura
+        if (nodo != nodoPrelectura || shuffle != shufflePrelectura || colaExtendida) {
+            if (nodo != nodoPrelectura) {
+                precargador.registrarInicio(nodo->cancion.ruta());
+                recientes.push_back(idPista(nodo->cancion));
+                if (recientes.size() > AUTOCOLA_HISTORIA) recientes.erase(recientes.begin());
+            }
+            nodoPrelectura = nodo;
+            shufflePrelectura = shuffle;
+            colaExtendida = false;
+            precargador.programar(proximasRutas());
+
+            // Buscar más canciones antes de que se acabe la playlist
+            if (similares && !similares->pidiendo() && restantes() <= AUTOCOLA_RESTANTES) {
+                unordered_set<uint64_t> excluir;
+                for (NodoCancion* n : orden) excluir.insert(idPista(n->cancion));
+                similares->pedir(recientes, move(excluir));
+            }
+        }
+
+        mostrarVistaReproductor(pl, shuffle, (int)posicion + 1, nodo, precargador.resumen() + "\n" + latenciaCambio.resumen());
+        mostrarTiempoActual(e.segundos, e.duracion);
+
+        // Usar un timeout más corto para detectar cambios más rápido
+        struct termios oldt, newt;
+        tcgetattr(STDIN_FILENO, &oldt);
+        newt = oldt;
+        newt.c_lflag &= ~(ICANON | ECHO);
+        tcsetattr(STDIN_FILENO, TCSANOW, &newt);
+        
+        // Configurar timeout para redibujar el tiempo y detectar el avance automático
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(STDIN_FILENO, &fds);
+        struct timeval timeout;
+        timeout.tv_sec = 0;
+        timeout.tv_usec = 500000; // 500ms
+        
+        char tecla = 0;
+        int result = select(STDIN_FILENO + 1, &fds, NULL, NULL, &timeout);
+        if (result > 0 && FD_ISSET(STDIN_FILENO, &fds)) {
+            tecla = getchar();
+        }
+        
+        tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
+        
+        // Sin tecla: volver a consultar el estado
+        if (result == 0 || tecla == 0) continue;
+
+        // Las órdenes van al controlador; la vista se actualiza con su estado
+        switch (tecla) {
+            case 'r':
+            case 'R':
+                controlador.reproducir();
+                break;
+            case 'p':
+            case 'P':
+                controlador.alternarPausa();
+                break;
+            case 's':
+            case 'S':
+                if (restantes() == 0) extenderCola();
+                controlador.saltar(1);
+                controlador.sincronizar();
+                if (controlador.estado().estado == DETENIDO) {
+                    cout << (shuffle ? "\rFin de la lista aleatoria." : "\rFin de la lista.") << endl;
+                    pausa();
+                }
+                break;
+            case 'a':
+            case 'A':
+                controlador.saltar(-1);
+                controlador.sincronizar();
+                if (controlador.estado().estado == DETENIDO) {
+                    cout << (shuffle ? "\rInicio de la lista aleatoria." : "\rInicio de la lista.") << endl;
+                    pausa();
+                }
+                break;
+            case 'f':
+            case 'F':
+                controlador.buscar(SALTO_SEGUNDOS);
+                break;
+            case 'b':
+            case 'B':
+                controlador.buscar(-SALTO_SEGUNDOS);
+                break;
+            case '+':
+            case '-': {
+                // Sin reiniciar nada: el hilo de audio toma la nueva velocidad en el siguiente bloque
+                double v = velocidad + (tecla == '+' ? PASO_VELOCIDAD : -PASO_VELOCIDAD);
+                velocidad = max(VELOCIDAD_MINIMA, min(VELOCIDAD_MAXIMA, v));
+                break;
+            }
+            case 'm':
+            case 'M':
+                // La canción actual sigue sonando; solo cambia lo que viene después
+                shuffle = !shuffle;
+                recalcularOrden();
+                controlador.establecerCola(cancionesDe(orden), posicion, false);
+                controlador.sincronizar();
+                break;
+            case 'q':
+            case 'Q':
+                controlador.detener();
+                salir = true;
+                break;
+            default:
+                break;
+        }
+    }
+    // Al destruirse, el controlador detiene la tubería y descarta la reserva
+}
+
+// --- Explorador de la biblioteca ---
+//
+// Muestra la biblioteca por páginas, ordenada y agrupada a elección. Cada
+// combinación de grupo y orden se calcula una sola vez, con una ordenación en
+// paralelo, y se guarda como un arreglo de índices sobre la biblioteca: cambiar
+// de orden o de página después es inmediato aunque haya un millón de canciones.
+
+enum CriterioOrden { ORDEN_ORIGINAL, ORDEN_ARTISTA, ORDEN_TITULO, ORDEN_DURACION, ORDEN_DIRECTORIO, NUM_ORDENES };
+enum CriterioGrupo { GRUPO_NINGUNO, GRUPO_ARTISTA, GRUPO_DIRECTORIO, NUM_GRUPOS };
+
+const char* NOMBRES_ORDEN[NUM_ORDENES] = {"original", "artista", "título", "duración", "directorio"};
+const char* NOMBRES_GRUPO[NUM_GRUPOS] = {"ninguno", "artista", "directorio"};
+
+// Ordena por tramos en varios hilos y luego mezcla los tramos por pares
+template <typename Comparar>
+void ordenarEnParalelo(vector<uint32_t>& v, Comparar comp) {
+    size_t hilos = max(1u, thread::hardware_concurrency());
+    if (hilos == 1 || v.size() < 65536) {
+        sort(v.begin(), v.end(), comp);
+        return;
+    }
+    vector<size_t> cortes;
+    for (size_t i = 0; i <= hilos; ++i) cortes.push_back(v.size() * i / hilos);
+
+    vector<thread> trabajadores;
+    for (size_t i = 0; i < hilos; ++i) {
+        trabajadores.emplace_back([&, i]{ sort(v.begin() + cortes[i], v.begin() + cortes[i + 1], comp); });
+    }
+    for (thread& t : trabajadores) t.join();
+
+    // Cada ronda mezcla tramos vecinos, a la mitad de tramos cada vez
+    while (cortes.size() > 2) {
+        vector<size_t> siguientes;
+        trabajadores.clear();
+        for (size_t i = 0; i + 1 < cortes.size(); i += 2) {
+            siguientes.push_back(cortes[i]);
+            if (i + 2 < cortes.size()) {
+                size_t a = cortes[i], m = cortes[i + 1], b = cortes[i + 2];
+                trabajadores.emplace_back([&v, a, m, b, &comp]{ inplace_merge(v.begin() + a, v.begin() + m, v.begin() + b, comp); });
+            }
+        }
+        siguientes.push_back(cortes.back());
+        for (thread& t : trabajadores) t.join();
+        cortes.swap(siguientes);
+    }
+}
+
+// Lee una tecla sin esperar ENTER
+char leerTecla() {
+    struct termios oldt, newt;
+    tcgetattr(STDIN_FILENO, &oldt);
+    newt = oldt;
+    newt.c_lflag &= ~(ICANON | ECHO);
+    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
+    int c = getchar();
+    tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
+    return c == EOF ? 'q' : (char)c;
+}
+
+class ExploradorBiblioteca {
+public:
+    explicit ExploradorBiblioteca(const vector<Cancion>& canciones) : canciones(canciones) {}
+
+    void explorar() {
+        size_t pagina = 0;
+        while (true) {
+            const vector<uint32_t>& perm = permutacion();
+            const vector<size_t>& inicios = paginar(perm, filasPorPagina());
+            if (pagina >= inicios.size()) pagina = inicios.size() - 1;
+            size_t hasta = pagina + 1 < inicios.size() ? inicios[pagina + 1] : perm.size();
+            mostrarPagina(perm, pagina, inicios.size(), inicios[pagina], hasta);
+
+            switch (leerTecla()) {
+                case 'n': case 'N': case ' ':
+                    if (pagina + 1 < inicios.size()) pagina++;
+                    break;
+                case 'p': case 'P':
+                    if (pagina > 0) pagina--;
+                    break;
+                case 'i': case 'I':
+                    pagina = 0;
+                    break;
+                case 'f': case 'F':
+                    pagina = inicios.size() - 1;
+                    break;
+                case 'o': case 'O':
+                    orden = (orden + 1) % NUM_ORDENES;
+                    pagina = 0;
+                    break;
+                case 'g': case 'G':
+                    grupo = (grupo + 1) % NUM_GRUPOS;
+                    pagina = 0;
+                    break;
+                case 'q': case 'Q':
+                    return;
+                default:
+                    break;
+            }
+        }
+    }
+
+private:
+    const vector<Cancion>& canciones;
+    int orden = ORDEN_ORIGINAL;
+    int grupo = GRUPO_NINGUNO;
+    unordered_map<int, vector<uint32_t>> permutaciones; // Clave: grupo * NUM_ORDENES + orden
+    double msUltimoCalculo = -1;
+    vector<size_t> iniciosPagina;     // Primera posición de cada página...
+    const vector<uint32_t>* permPaginada = nullptr;
+    size_t filasPaginadas = 0;        // ...para esta permutación y este alto
+
+    // Comparación por grupo y por orden: negativo, 0 o positivo como strcmp
+    static int compararGrupo(int grupo, const Cancion& a, const Cancion& b) {
+        if (grupo == GRUPO_ARTISTA) return a.artista.compare(b.artista);
+        if (grupo == GRUPO_DIRECTORIO) return a.directorio.compare(b.directorio);
+        return 0;
+    }
+
+    static int compararOrden(int orden, const Cancion& a, const Cancion& b) {
+        switch (orden) {
+            case ORDEN_ARTISTA: return a.artista.compare(b.artista);
+            case ORDEN_TITULO: return a.titulo.compare(b.titulo);
+            case ORDEN_DIRECTORIO: return a.directorio.compare(b.directorio);
+            case ORDEN_DURACION:
+                return a.duracion_minutos < b.duracion_minutos ? -1 : (a.duracion_minutos > b.duracion_minutos ? 1 : 0);
+            default: return 0;
+        }
+    }
+
+    const vector<uint32_t>& permutacion() {
+        int clave = grupo * NUM_ORDENES + orden;
+        auto it = permutaciones.find(clave);
+        if (it != permutaciones.end()) {
+            msUltimoCalculo = -1;
+            return it->second;
+        }
+
+        auto inicio = chrono::steady_clock::now();
+        vector<uint32_t> perm(canciones.size());
+        for (size_t i = 0; i < perm.size(); ++i) perm[i] = i;
+        if (grupo != GRUPO_NINGUNO || orden != ORDEN_ORIGINAL) {
+            int g = grupo, o = orden;
+            const vector<Cancion>& c = canciones;
+            // El índice desempata: el resultado no depende del número de hilos
+            ordenarEnParalelo(perm, [g, o, &c](uint32_t a, uint32_t b) {
+                int r = compararGrupo(g, c[a], c[b]);
+                if (r == 0) r = compararOrden(o, c[a], c[b]);
+                return r != 0 ? r < 0 : a < b;
+            });
+        }
+        msUltimoCalculo = chrono::duration<double, milli>(chrono::steady_clock::now() - inicio).count();
+        return permutaciones[clave] = move(perm);
+    }
+
+    static size_t filasPorPagina() {
+        struct winsize ws;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 12) return ws.ws_row - 8;
+        return 20;
+    }
+
+    const string& valorGrupo(const Cancion& c) const {
+        return grupo == GRUPO_ARTISTA ? c.artista : c.directorio;
+    }
+
+    // Posición inicial de cada página. Con grupos, cada encabezado ocupa una
+    // fila (incluido el que repite el grupo al empezar la página), así que la
+    // página nunca pasa del alto de la terminal
+    const vector<size_t>& paginar(const vector<uint32_t>& perm, size_t porPagina) {
+        if (permPaginada == &perm && filasPaginadas == porPagina) return iniciosPagina;
+        permPaginada = &perm;
+        filasPaginadas = porPagina;
+        iniciosPagina.assign(1, 0);
+        if (grupo == GRUPO_NINGUNO) {
+            for (size_t i = porPagina; i < perm.size(); i += porPagina) iniciosPagina.push_back(i);
+            return iniciosPagina;
+        }
+        size_t filas = 0;
+        for (size_t i = 0; i < perm.size(); ++i) {
+            bool encabezado = filas == 0 || valorGrupo(canciones[perm[i]]) != valorGrupo(canciones[perm[i - 1]]);
+            size_t necesarias = encabezado ? 2 : 1;
+            if (filas > 0 && filas + necesarias > porPagina) {
+                iniciosPagina.push_back(i);
+                filas = 0;
+                necesarias = 2;
+            }
+            filas += necesarias;
+        }
+        return iniciosPagina;
+    }
+
+    void mostrarPagina(const vector<uint32_t>& perm, size_t pagina, size_t paginas, size_t desde, size_t hasta) {
+        // Toda la página se arma en memoria y se escribe de una sola vez
+        ostringstream out;
+        out << "\033[2J\033[1;1H";
+        out << "Canciones disponibles: " << canciones.size()
+            << " | Página " << pagina + 1 << " de " << paginas
+            << " | Orden: " << NOMBRES_ORDEN[orden] << " | Grupo: " << NOMBRES_GRUPO[grupo];
+        if (msUltimoCalculo >= 0) out << " (ordenado en " << (long)msUltimoCalculo << " ms)";
+        out << "\n------------------------------------------\n";
+
+        const string* grupoActual = nullptr;
+        for (size_t i = desde; i < hasta; ++i) {
+            const Cancion& c = canciones[perm[i]];
+            if (grupo != GRUPO_NINGUNO && (!grupoActual || *grupoActual != valorGrupo(c))) {
+                grupoActual = &valorGrupo(c);
+                out << "== " << *grupoActual << " ==\n";
+            }
+            int min = (int)c.duracion_minutos;
+            int seg = (int)((c.duracion_minutos - min) * 60);
+            out << perm[i] + 1 << ". " << c.titulo << " - " << c.artista
+                << " (" << min << "m " << seg << "s)\n";
+        }
+        out << "------------------------------------------\n"
+            << "[N] Siguiente  [P] Anterior  [I] Inicio  [F] Fin\n"
+            << "[O] Cambiar orden  [G] Cambiar grupo  [Q] Volver\n";
+        cout << out.str() << flush;
+    }
+};
+
+// --- Estadísticas de reproducción ---
+
+void mostrarEstadisticas(HistorialReproduccion& historial, const vector<Cancion>& biblioteca) {
+    unordered_map<uint64_t, const Cancion*> porId;
+    for (const Cancion& c : biblioteca) porId[idPista(c)] = &c;
+    auto nombre = [&](uint64_t id) {
+        auto it = porId.find(id);
+        return it != porId.end() ? it->second->titulo + " - " + it->second->artista : string("(fuera de la biblioteca)");
+    };
+
+    // Desde el día 1 del mes en curso
+    time_t ahora = time(nullptr);
+    struct tm inicioMes;
+    localtime_r(&ahora, &inicioMes);
+    inicioMes.tm_mday = 1;
+    inicioMes.tm_hour = inicioMes.tm_min = inicioMes.tm_sec = 0;
+
+    auto t0 = chrono::steady_clock::now();
+    auto top = historial.masReproducidas((int64_t)mktime(&inicioMes), (int64_t)ahora + 1, 100);
+    auto t1 = chrono::steady_clock::now();
+    vector<size_t> nunca = historial.nuncaReproducidas(biblioteca);
+    auto t2 = chrono::steady_clock::now();
+
+    cout << "Eventos registrados: " << historial.totalEventos() << endl;
+    cout << "Más reproducidas este mes (" << fixed << setprecision(2)
+         << chrono::duration<double, milli>(t1 - t0).count() << " ms):" << endl;
+    for (size_t i = 0; i < top.size() && i < 10; ++i) {
+        AgregadoPista a = historial.agregado(top[i].first);
+        cout << i+1 << ". " << nombre(top[i].first) << " [" << top[i].second << " este mes, "
+             << a.reproducciones << " en total, " << a.saltos << " saltos, "
+             << a.segundosEscuchados / 60 << " min escuchados]" << endl;
+    }
+    cout << "Nunca reproducidas: " << nunca.size() << " ("
+         << chrono::duration<double, milli>(t2 - t1).count() << " ms)" << endl;
+    cout.unsetf(ios::fixed);
+    for (size_t i = 0; i < nunca.size() && i < 10; ++i) {
+        cout << "   " << biblioteca[nunca[i]].titulo << " - " << biblioteca[nunca[i]].artista << endl;
+    }
+}
+
+// --- Menú del ecualizador ---
+
+// Lee un número de una línea de cin; false (y 'valor' intacto) si la línea
+// quedó vacía o no es un número
+template <typename T>
+bool leerNumero(const string& pregunta, T& valor) {
+    cout << pregunta;
+    string linea;
+    if (!getline(cin, linea)) return false;
+    istringstream entrada(linea);
+    T leido;
+    if (!(entrada >> leido) || !(entrada >> ws).eof()) return false;
+    valor = leido;
+    return true;
+}
+
+void menuEcualizador(Sesion& sesion) {
+    PresetsEcualizador& presets = sesion.presets();
+    vector<BandaEcualizador> bandas = presets.bandasActivas();
+    int opcion;
+    do {
+        limpiarPantalla();
+        cout << "=== ECUALIZADOR ===" << endl;
+        cout << "Preset actual: " << (presets.activo.empty() ? "(plano)" : presets.activo) << endl;
+        cout << "Presets guardados en " << PresetsEcualizador::rutaPara(sesion.rutaPlaylist) << ":";
+        for (auto& p : presets.presets) cout << " [" << p.first << "]";
+        cout << endl << "------------------------------------------" << endl;
+        for (size_t i = 0; i < bandas.size(); ++i) {
+            const BandaEcualizador& b = bandas[i];
+            cout << i+1 << ". " << NOMBRES_FILTRO[b.tipo] << " " << b.frecuencia << " Hz";
+            if (b.tipo == FILTRO_PICO || b.tipo == FILTRO_GRAVES || b.tipo == FILTRO_AGUDOS) cout << " " << b.gananciaDb << " dB";
+            cout << " Q " << b.q << endl;
+        }
+        if (bandas.empty()) cout << "(sin bandas)" << endl;
+        cout << "------------------------------------------" << endl;
+        cout << "1. Agregar banda" << endl;
+        cout << "2. Eliminar banda" << endl;
+        cout << "3. Guardar como preset" << endl;
+        cout << "4. Usar un preset guardado" << endl;
+        cout << "5. Plano (sin ecualizar)" << endl;
+        cout << "6. Volver" << endl;
+        if (!leerNumero("Seleccione una opción: ", opcion)) opcion = 0;
+
+        switch (opcion) {
+            case 1: {
+                if (bandas.size() >= (size_t)MAX_BANDAS) {
+                    cout << "Máximo " << MAX_BANDAS << " bandas." << endl;
+                    pausa();
+                    break;
+                }
+                for (int t = 0; t < NUM_FILTROS; ++t) cout << t << " = " << NOMBRES_FILTRO[t] << (t + 1 < NUM_FILTROS ? ", " : "\n");
+                int tipo;
+                BandaEcualizador b;
+                if (!leerNumero("Tipo: ", tipo) || tipo < 0 || tipo >= NUM_FILTROS ||
+                    !leerNumero("Frecuencia (Hz): ", b.frecuencia) || b.frecuencia <= 0) {
+                    cout << "Valor inválido." << endl;
+                    pausa();
+                    break;
+                }
+                b.tipo = (TipoFiltro)tipo;
+                if (b.tipo == FILTRO_PICO || b.tipo == FILTRO_GRAVES || b.tipo == FILTRO_AGUDOS) {
+                    if (!leerNumero("Ganancia (dB): ", b.gananciaDb)) b.gananciaDb = 0;
+                }
+                if (!leerNumero("Q (ENTER = 0.707): ", b.q) || b.q <= 0) b.q = 0.707;
+                bandas.push_back(b);
+                ecualizador.configurar(bandas);
+                break;
+            }
+            case 2: {
+                int num;
+                if (leerNumero("¿Qué banda deseas eliminar? Ingresa el número: ", num) && num >= 1 && num <= (int)bandas.size()) {
+                    bandas.erase(bandas.begin() + num - 1);
+                    ecualizador.configurar(bandas);
+                }
+                break;
+            }
+            case 3: {
+                cout << "Nombre del preset: ";
+                string nombre;
+                getline(cin, nombre);
+                if (nombre.empty()) break;
+                presets.presets[nombre] = bandas;
+                presets.activo = nombre;
+                sesion.guardarPresets();
+                cout << "Preset guardado." << endl;
+                pausa();
+                break;
+            }
+            case 4: {
+                cout << "Nombre del preset: ";
+                string nombre;
+                getline(cin, nombre);
+                if (presets.presets.count(nombre)) {
+                    presets.activo = nombre;
+                    bandas = presets.bandasActivas();
+                    ecualizador.configurar(bandas);
+                    sesion.guardarPresets(); // Recordar el preset activo
+                } else {
+                    cout << "No existe ese preset." << endl;
+                    pausa();
+                }
+                break;
+            }
+            case 5:
+                bandas.clear();
+                presets.activo.clear();
+                ecualizador.configurar(bandas);
+                sesion.guardarPresets();
+                break;
+            default:
+                break;
+        }
+    } while (opcion != 6);
+}
+
+// Reproduce la playlist de la sesión con su preset de ecualizador y la cola automática
+void reproducirPlaylist(Sesion& sesion) {
+    ecualizador.configurar(sesion.presets().bandasActivas());
+    ColaSimilares similares(obtenerRutaEjecutable() + "/caracteristicas.bin", sesion.rutaCanciones);
+    modoReproductor(sesion.playlist(), sesion.historial(), &similares);
+}
+
+// --- Menú principal ---
+
+void menuPrincipal() {
+    cout << "=== SIMPLE PLAYER ===" << endl;
+    cout << "1. Mostrar canciones disponibles" << endl;
+    cout << "2. Agregar canción a mi playlist" << endl;
+    cout << "3. Mostrar playlist completa" << endl;
+    cout << "4. Mostrar duración total de la lista" << endl;
+    cout << "5. Reproducir playlist" << endl;
+    cout << "6. Guardar mi lista" << endl;
+    cout << "7. Eliminar canción de mi playlist" << endl;
+    // Las opciones nuevas van al final de la numeración: Salir sigue siendo la 8
+    cout << "9. Estadísticas de reproducción" << endl;
+    cout << "10. Ecualizador" << endl;
+    cout << "8. Salir" << endl;
     cout << "Seleccione una opción: ";
 }
 
-int main() {
-    // Configurar manejador de señal SIGCHLD
-    signal(SIGCHLD, manejadorSIGCHLD);
+// --- Exportar una playlist a un solo archivo de audio ---
+//
+// simpleplayer --render <playlist> <salida.wav|salida.flac>
+// Se hace en dos pasadas. La primera decodifica cada canción sin guardarla y
+// solo mide su volumen. La segunda vuelve a decodificarlas, varias a la vez,
+// cada una con su ffmpeg, y aplica la ganancia. El audio viaja en bloques de
+// RENDER_BLOQUE muestras por un buffer de reordenamiento y se escribe en el
+// orden de la playlist. El buffer no pasa de RENDER_MEMORIA bytes: un hilo
+// espera antes de encolar más, salvo el de la canción que se está escribiendo,
+// que siempre puede tener un par de bloques. Así la memoria no depende ni del
+// largo de las canciones ni del número de núcleos.
+
+const double RENDER_RMS_OBJETIVO = 0.125;  // -18 dBFS
+const double RENDER_PICO_MAXIMO = 0.891;   // -1 dBFS
+const size_t RENDER_BLOQUE = 256 * 1024;        // Muestras por bloque (512 KB)
+const size_t RENDER_MEMORIA = 64 * 1024 * 1024; // Bytes en el buffer de reordenamiento
+
+// Decodifica un archivo a PCM de 16 bits y entrega el audio en bloques de a lo
+// sumo RENDER_BLOQUE muestras; alBloque puede quedarse con el vector. Devuelve
+// false si ffmpeg falló o no produjo audio
+bool decodificarPorBloques(const string& ruta, const function<void(vector<int16_t>&)>& alBloque) {
+    int pcm[2];
+    if (pipe2(pcm, O_CLOEXEC) != 0) return false;
+    pid_t pid = lanzarProceso(argumentosDecodificador(ruta, 0, "s16le"), -1, pcm[1]);
+    close(pcm[1]);
+
+    vector<int16_t> bloque(RENDER_BLOQUE);
+    const size_t bytesBloque = RENDER_BLOQUE * sizeof(int16_t);
+    size_t bytes = 0;
+    uint64_t total = 0;
+    while (true) {
+        ssize_t n = read(pcm[0], reinterpret_cast<char*>(bloque.data()) + bytes, bytesBloque - bytes);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        bytes += n;
+        if (bytes == bytesBloque) {
+            total += RENDER_BLOQUE;
+            alBloque(bloque);
+            bloque.resize(RENDER_BLOQUE);
+            bytes = 0;
+        }
+    }
+    close(pcm[0]);
+    int estado = 0;
+    waitpid(pid, &estado, 0);
+
+    // El último bloque, recortado a frames completos
+    size_t resto = bytes / (sizeof(int16_t) * CANALES) * CANALES;
+    if (resto > 0) {
+        bloque.resize(resto);
+        total += resto;
+        alBloque(bloque);
+    }
+    return WIFEXITED(estado) && WEXITSTATUS(estado) == 0 && total > 0;
+}
+
+// Primera pasada: ganancia que lleva la canción al volumen común sin pasar del
+// pico máximo. Solo recorre el audio, no lo guarda
+bool medirGanancia(const string& ruta, double& ganancia) {
+    double suma = 0;
+    int pico = 1;
+    uint64_t muestras = 0;
+    bool ok = decodificarPorBloques(ruta, [&](vector<int16_t>& bloque) {
+        for (int16_t m : bloque) {
+            suma += (double)m * m;
+            pico = max(pico, abs((int)m));
+        }
+        muestras += bloque.size();
+    });
+    double rms = sqrt(suma / max<uint64_t>(1, muestras)) / 32768.0;
+    ganancia = rms > 0 ? RENDER_RMS_OBJETIVO / rms : 1.0;
+    ganancia = min(ganancia, RENDER_PICO_MAXIMO / (pico / 32768.0));
+    return ok;
+}
+
+void aplicarGanancia(vector<int16_t>& muestras, double ganancia) {
+    for (int16_t& m : muestras) {
+        double v = m * ganancia;
+        m = (int16_t)lrint(v > 32767 ? 32767 : (v < -32768 ? -32768 : v));
+    }
+}
+
+int renderizarPlaylist(const string& rutaPlaylist, const string& rutaSalida) {
+    Playlist pl;
+    pl.cargar(rutaPlaylist);
+    vector<NodoCancion*> pistas = pl.nodosVector();
+    if (pistas.empty()) {
+        cerr << "La playlist " << rutaPlaylist << " está vacía o no existe." << endl;
+        return 1;
+    }
+
+    // WAV directo; cualquier otra extensión (p. ej. .flac) la codifica ffmpeg
+    bool esWav = rutaSalida.size() >= 4 && minusculas(rutaSalida.substr(rutaSalida.size() - 4)) == ".wav";
+    int fdSalida = -1;
+    pid_t pidCodificador = 0;
+    if (esWav) {
+        fdSalida = open(rutaSalida.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fdSalida >= 0) escribirCabeceraWav(fdSalida);
+    } else {
+        int tubo[2];
+        if (pipe2(tubo, O_CLOEXEC) == 0) {
+            pidCodificador = lanzarProceso({"ffmpeg", "-nostdin", "-v", "error", "-y",
+                                            "-f", "s16le", "-ar", to_string(FRECUENCIA_MUESTREO),
+                                            "-ac", to_string(CANALES), "-i", "pipe:0", rutaSalida}, tubo[0], -1);
+            close(tubo[0]);
+            fdSalida = tubo[1];
+        }
+    }
+    if (fdSalida < 0) {
+        cerr << "No se pudo crear " << rutaSalida << endl;
+        return 1;
+    }
+
+    size_t hilos = max(1u, thread::hardware_concurrency());
+    const size_t RENDER_VENTANA = hilos + 1;
+    auto inicio = chrono::steady_clock::now();
+
+    // Primera pasada: medir el volumen de todas, en cualquier orden
+    vector<double> ganancias(pistas.size(), 1.0);
+    vector<char> fallidas(pistas.size(), false);
+    {
+        atomic<size_t> siguiente(0), hechas(0);
+        auto medir = [&]() {
+            size_t i;
+            while ((i = siguiente++) < pistas.size()) {
+                fallidas[i] = !medirGanancia(pistas[i]->cancion.ruta(), ganancias[i]);
+                hechas++;
+            }
+        };
+        vector<thread> trabajadores;
+        for (size_t h = 0; h < hilos; ++h) trabajadores.emplace_back(medir);
+        while (hechas < pistas.size()) {
+            cout << "\rMidiendo volumen " << hechas << "/" << pistas.size() << flush;
+            this_thread::sleep_for(chrono::milliseconds(200));
+        }
+        for (thread& t : trabajadores) t.join();
+        cout << "\rMidiendo volumen " << hechas << "/" << pistas.size() << endl;
+    }
+
+    // Segunda pasada: decodificar de nuevo y pasar los bloques en orden
+    struct BloquesPista {
+        deque<vector<int16_t>> bloques;
+        bool terminada = false;
+    };
+    mutex mtx;
+    condition_variable cv;
+    vector<BloquesPista> colas(pistas.size());   // Buffer de reordenamiento
+    size_t bytesEnBuffer = 0;
+    size_t siguienteATomar = 0;
+    size_t siguienteAEscribir = 0;
+
+    auto trabajar = [&]() {
+        while (true) {
+            size_t i;
+            {
+                unique_lock<mutex> lk(mtx);
+                cv.wait(lk, [&]{ return siguienteATomar >= pistas.size() || siguienteATomar < siguienteAEscribir + RENDER_VENTANA; });
+                if (siguienteATomar >= pistas.size()) return;
+                i = siguienteATomar++;
+            }
+            // Las que fallaron en la primera pasada no se vuelven a decodificar
+            bool omitida = fallidas[i];
+            bool decodificada = !omitida && decodificarPorBloques(pistas[i]->cancion.ruta(), [&](vector<int16_t>& bloque) {
+                aplicarGanancia(bloque, ganancias[i]);
+                size_t bytes = bloque.size() * sizeof(int16_t);
+                {
+                    unique_lock<mutex> lk(mtx);
+                    cv.wait(lk, [&]{
+                        return bytesEnBuffer + bytes <= RENDER_MEMORIA ||
+                               (i == siguienteAEscribir && colas[i].bloques.size() < 2);
+                    });
+                    bytesEnBuffer += bytes;
+                    colas[i].bloques.push_back(move(bloque));
+                }
+                cv.notify_all();
+            });
+            {
+                lock_guard<mutex> lk(mtx);
+                if (!decodificada) fallidas[i] = true;
+                colas[i].terminada = true;
+            }
+            cv.notify_all();
+        }
+    };
+
+    vector<thread> trabajadores;
+    for (size_t h = 0; h < hilos; ++h) trabajadores.emplace_back(trabajar);
+
+    // Escribir en orden a medida que llegan los bloques
+    uint64_t framesEscritos = 0;
+    bool errorEscritura = false;
+    while (siguienteAEscribir < pistas.size()) {
+        const Cancion& c = pistas[siguienteAEscribir]->cancion;
+        cout << "[" << siguienteAEscribir + 1 << "/" << pistas.size() << "] " << c.titulo << " - " << c.artista << flush;
+        BloquesPista& cola = colas[siguienteAEscribir];
+        uint64_t framesPista = 0;
+        bool fallida;
+        while (true) {
+            vector<int16_t> bloque;
+            {
+                unique_lock<mutex> lk(mtx);
+                cv.wait(lk, [&]{ return !cola.bloques.empty() || cola.terminada; });
+                if (cola.bloques.empty()) {
+                    fallida = fallidas[siguienteAEscribir];
+                    break;
+                }
+                bloque = move(cola.bloques.front());
+                cola.bloques.pop_front();
+                bytesEnBuffer -= bloque.size() * sizeof(int16_t);
+            }
+            cv.notify_all();
+            if (!errorEscritura && !escribirTodo(fdSalida, bloque.data(), bloque.size() * sizeof(int16_t))) {
+                errorEscritura = true;
+            }
+            framesPista += bloque.size() / CANALES;
+        }
+        framesEscritos += framesPista;
+        if (fallida && framesPista == 0) cout << " (no se pudo decodificar, omitida)" << endl;
+        else if (fallida) cout << " (falló a mitad de la decodificación, " << framesPista / FRECUENCIA_MUESTREO << " s)" << endl;
+        else cout << " (" << framesPista / FRECUENCIA_MUESTREO << " s)" << endl;
+        {
+            lock_guard<mutex> lk(mtx);
+            siguienteAEscribir++;
+        }
+        cv.notify_all();
+    }
+    for (thread& t : trabajadores) t.join();
+
+    if (esWav) {
+        // Ahora que se conoce el tamaño, corregir la cabecera
+        uint64_t datos = framesEscritos * CANALES * sizeof(int16_t);
+        uint8_t h[44];
+        armarCabeceraWav(h, (uint32_t)min<uint64_t>(datos, WAV_TAMANO_DESCONOCIDO - 36));
+        if (pwrite(fdSalida, h, sizeof(h), 0) != (ssize_t)sizeof(h)) errorEscritura = true;
+    }
+    close(fdSalida);
+    if (pidCodificador > 0) {
+        int estado = 0;
+        waitpid(pidCodificador, &estado, 0);
+        if (!WIFEXITED(estado) || WEXITSTATUS(estado) != 0) errorEscritura = true;
+    }
+
+    double segundosMuro = chrono::duration<double>(chrono::steady_clock::now() - inicio).count();
+    double segundosAudio = (double)framesEscritos / FRECUENCIA_MUESTREO;
+    cout << fixed << setprecision(1)
+         << "Exportados " << segundosAudio << " s de audio en " << segundosMuro << " s ("
+         << segundosAudio / max(segundosMuro, 1e-9) << " s de audio por segundo, "
+         << hilos << " hilos)" << endl;
+    if (errorEscritura) {
+        cerr << "Error al escribir " << rutaSalida << endl;
+        return 1;
+    }
+    return count(fallidas.begin(), fallidas.end(), (char)true) > 0 ? 1 : 0;
+}
+
+// --- Verificación de la biblioteca ---
+//
+// simpleplayer --verify [reporte.json] [--jobs N]
+// Decodifica por completo cada canción de canciones.json, varias a la vez, y
+// detecta errores de decodificación, archivos truncados y duraciones que no
+// coinciden con duracion_minutos. Lo que ffmpeg devolvió para cada archivo se
+// guarda en caché junto con su tamaño y fecha de modificación: en la siguiente
+// pasada solo se decodifica lo que cambió. La clasificación se rehace siempre,
+// porque depende de duracion_minutos y esa puede haberse corregido.
+
+const int VERIFICAR_FRECUENCIA = 8000;       // Basta para contar la duración; abarata el remuestreo
+const double VERIFICAR_TOLERANCIA_S = 2.0;   // Diferencia admitida en segundos...
+const double VERIFICAR_TOLERANCIA_REL = 0.02; // ...o relativa, la mayor de las dos
+
+struct ResultadoVerificacion {
+    string estado;            // ok, no_existe, error_decodificacion, truncado, duracion_discrepante
+    bool terminoBien = false; // ffmpeg salió con código 0
+    double segundos = 0;      // Duración decodificada
+    string detalle;           // Primeras líneas de error de ffmpeg
+};
+
+// Clasifica lo decodificado frente a la duración que indica canciones.json
+string clasificarVerificacion(const ResultadoVerificacion& r, double segundosEsperados) {
+    double tolerancia = max(VERIFICAR_TOLERANCIA_S, segundosEsperados * VERIFICAR_TOLERANCIA_REL);
+    if (!r.terminoBien || r.segundos <= 0) return "error_decodificacion";
+    if (r.segundos < segundosEsperados - tolerancia) return "truncado";
+    if (!r.detalle.empty()) return "error_decodificacion";
+    if (r.segundos > segundosEsperados + tolerancia) return "duracion_discrepante";
+    return "ok";
+}
+
+// Decodifica el archivo completo contando muestras y guardando lo que ffmpeg reporte
+ResultadoVerificacion verificarArchivo(const string& ruta) {
+    ResultadoVerificacion r;
+    int salida[2], errores[2];
+    if (pipe2(salida, O_CLOEXEC) != 0) {
+        r.detalle = "no se pudo crear la tubería";
+        return r;
+    }
+    if (pipe2(errores, O_CLOEXEC) != 0) {
+        close(salida[0]);
+        close(salida[1]);
+        r.detalle = "no se pudo crear la tubería";
+        return r;
+    }
+    pid_t pid = lanzarProceso({"ffmpeg", "-nostdin", "-v", "error", "-i", ruta, "-vn",
+                               "-f", "s16le", "-ac", "1", "-ar", to_string(VERIFICAR_FRECUENCIA), "pipe:1"},
+                              -1, salida[1], errores[1]);
+    close(salida[1]);
+    close(errores[1]);
+
+    // Leer ambas tuberías a la vez para que ffmpeg no se bloquee en ninguna
+    uint64_t bytes = 0;
+    vector<char> bloque(64 * 1024);
+    struct pollfd fds[2] = {{salida[0], POLLIN, 0}, {errores[0], POLLIN, 0}};
+    int abiertas = 2;
+    while (abiertas > 0) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int i = 0; i < 2; ++i) {
+            if (fds[i].fd < 0 || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            ssize_t n = read(fds[i].fd, bloque.data(), bloque.size());
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                close(fds[i].fd);
+                fds[i].fd = -1;
+                abiertas--;
+            } else if (i == 0) {
+                bytes += n;
+            } else if (r.detalle.size() < 500) {
+                r.detalle.append(bloque.data(), n);
+            }
+        }
+    }
+    int estado = 0;
+    waitpid(pid, &estado, 0);
+    while (!r.detalle.empty() && isspace((unsigned char)r.detalle.back())) r.detalle.pop_back();
+
+    r.terminoBien = WIFEXITED(estado) && WEXITSTATUS(estado) == 0;
+    r.segundos = (double)(bytes / sizeof(int16_t)) / VERIFICAR_FRECUENCIA;
+    return r;
+}
+
+// Entrada de la caché para un archivo con ese tamaño y fecha; una entrada con
+// otro formato o tipos incorrectos cuenta como ausente
+bool leerEntradaCache(const json& e, int64_t tamano, int64_t mtime, ResultadoVerificacion& r) {
+    if (!e.is_object()) return false;
+    auto t = e.find("tamano"), m = e.find("mtime"), b = e.find("termino_bien");
+    auto s = e.find("segundos"), d = e.find("detalle");
+    if (t == e.end() || !t->is_number_integer() || m == e.end() || !m->is_number_integer() ||
+        b == e.end() || !b->is_boolean() || s == e.end() || !s->is_number() ||
+        d == e.end() || !d->is_string()) {
+        return false;
+    }
+    if (t->get<int64_t>() != tamano || m->get<int64_t>() != mtime) return false;
+    r.terminoBien = b->get<bool>();
+    r.segundos = s->get<double>();
+    r.detalle = d->get<string>();
+    return true;
+}
+
+int verificarBiblioteca(Sesion& sesion, const string& rutaReporte, const string& rutaCache, size_t hilos) {
+    vector<Cancion> canciones = cargarCancionesDisponibles(sesion.rutaCanciones);
+    if (canciones.empty()) return 1;
+
+    // Caché: ruta -> tamaño, fecha de modificación y lo que devolvió ffmpeg
+    json cache = json::object();
+    {
+        ifstream f(rutaCache);
+        if (f.is_open()) {
+            cache = json::parse(f, nullptr, false);
+            if (cache.is_discarded() || !cache.is_object()) cache = json::object();
+        }
+    }
+
+    struct Pista {
+        string ruta;
+        int64_t tamano = -1;
+        int64_t mtime = 0;
+        bool enCache = false;
+        ResultadoVerificacion resultado;
+    };
+    vector<Pista> pistas(canciones.size());
+    vector<size_t> pendientes;
+    uint64_t bytesPendientes = 0;
+    for (size_t i = 0; i < canciones.size(); ++i) {
+        Pista& p = pistas[i];
+        p.ruta = canciones[i].ruta();
+        struct stat st;
+        if (stat(p.ruta.c_str(), &st) != 0) {
+            p.resultado.estado = "no_existe";
+            continue;
+        }
+        p.tamano = st.st_size;
+        p.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        auto it = cache.find(p.ruta);
+        if (it != cache.end() && leerEntradaCache(*it, p.tamano, p.mtime, p.resultado)) {
+            p.enCache = true;
+            continue;
+        }
+        pendientes.push_back(i);
+        bytesPendientes += st.st_size;
+    }
+    cout << canciones.size() << " canciones, " << pendientes.size() << " por decodificar ("
+         << canciones.size() - pendientes.size() << " sin cambios o inexistentes), "
+         << hilos << " hilos" << endl;
+
+    // Repartir las pendientes entre los hilos
+    atomic<size_t> siguiente(0), hechas(0);
+    auto inicio = chrono::steady_clock::now();
+    auto trabajar = [&]() {
+        size_t k;
+        while ((k = siguiente++) < pendientes.size()) {
+            size_t i = pendientes[k];
+            pistas[i].resultado = verificarArchivo(pistas[i].ruta);
+            hechas++;
+        }
+    };
+    vector<thread> trabajadores;
+    for (size_t h = 0; h < hilos; ++h) trabajadores.emplace_back(trabajar);
+    while (hechas < pendientes.size()) {
+        cout << "\rVerificadas " << hechas << "/" << pendientes.size() << flush;
+        this_thread::sleep_for(chrono::milliseconds(200));
+    }
+    for (thread& t : trabajadores) t.join();
+    if (!pendientes.empty()) cout << "\rVerificadas " << hechas << "/" << pendientes.size() << endl;
+    double segundosMuro = chrono::duration<double>(chrono::steady_clock::now() - inicio).count();
+
+    // Reporte, resumen y caché nueva
+    json reporte = json::array();
+    map<string, size_t> porEstado;
+    json cacheNueva = json::object();
+    double segundosAudio = 0;
+    for (size_t i = 0; i < pistas.size(); ++i) {
+        Pista& p = pistas[i];
+        ResultadoVerificacion& r = p.resultado;
+        if (p.tamano >= 0) r.estado = clasificarVerificacion(r, canciones[i].duracion_minutos * 60);
+        porEstado[r.estado]++;
+        reporte.push_back({
+            {"ruta", p.ruta},
+            {"artista", canciones[i].artista},
+            {"titulo", canciones[i].titulo},
+            {"estado", r.estado},
+            {"segundos_esperados", canciones[i].duracion_minutos * 60},
+            {"segundos_decodificados", r.segundos},
+            {"detalle", r.detalle},
+            {"en_cache", p.enCache}
+        });
+        if (p.tamano >= 0) {
+            cacheNueva[p.ruta] = {{"tamano", p.tamano}, {"mtime", p.mtime}, {"termino_bien", r.terminoBien},
+                                  {"segundos", r.segundos}, {"detalle", r.detalle}};
+        }
+        if (!p.enCache) segundosAudio += r.segundos;
+    }
+    ofstream(rutaReporte) << reporte.dump(2);
+    ofstream(rutaCache) << cacheNueva.dump();
+
+    for (auto& [estado, n] : porEstado) cout << estado << ": " << n << endl;
+    if (!pendientes.empty()) {
+        double s = max(segundosMuro, 1e-9);
+        cout << fixed << setprecision(1)
+             << "Decodificadas " << pendientes.size() << " canciones en " << segundosMuro << " s: "
+             << pendientes.size() / s << " canciones/s, " << bytesPendientes / s / (1024 * 1024) << " MB/s, "
+             << segundosAudio / s << " s de audio por segundo" << endl;
+        cout.unsetf(ios::fixed);
+    }
+    cout << "Reporte: " << rutaReporte << endl;
+    return porEstado["ok"] == pistas.size() ? 0 : 1;
+}
+
+// --- Análisis de la biblioteca para la cola automática ---
+//
+// simpleplayer --analyze [--jobs N]
+// Calcula las características de cada canción y las guarda en
+// caracteristicas.bin. Las canciones ya analizadas cuyo archivo no cambió
+// (mismo tamaño y fecha) se conservan sin volver a decodificarlas.
+
+int analizarBiblioteca(Sesion& sesion, const string& rutaIndice, size_t hilos) {
+    vector<Cancion> canciones = cargarCancionesDisponibles(sesion.rutaCanciones);
+    if (canciones.empty()) return 1;
+
+    unordered_map<uint64_t, RegistroCaracteristicas> previos;
+    for (const RegistroCaracteristicas& r : IndiceSimilitud::leerRegistros(rutaIndice)) previos[r.pista] = r;
+
+    vector<RegistroCaracteristicas> registros;
+    vector<pair<size_t, RegistroCaracteristicas>> pendientes;  // Canción -> registro por completar
+    unordered_set<uint64_t> vistas;
+    size_t inexistentes = 0;
+    for (size_t i = 0; i < canciones.size(); ++i) {
+        RegistroCaracteristicas r{};
+        r.pista = idPista(canciones[i]);
+        if (!vistas.insert(r.pista).second) continue;
+        struct stat st;
+        if (stat(canciones[i].ruta().c_str(), &st) != 0) {
+            inexistentes++;
+            continue;
+        }
+        r.tamano = st.st_size;
+        r.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        auto it = previos.find(r.pista);
+        if (it != previos.end() && it->second.tamano == r.tamano && it->second.mtime == r.mtime) {
+            registros.push_back(it->second);
+        } else {
+            pendientes.push_back({i, r});
+        }
+    }
+    cout << vistas.size() << " canciones, " << pendientes.size() << " por analizar, "
+         << registros.size() << " sin cambios, " << hilos << " hilos" << endl;
+
+    atomic<size_t> siguiente(0), hechas(0);
+    vector<char> correctas(pendientes.size(), 0);
+    auto inicio = chrono::steady_clock::now();
+    auto trabajar = [&]() {
+        size_t k;
+        while ((k = siguiente++) < pendientes.size()) {
+            correctas[k] = analizarArchivo(canciones[pendientes[k].first].ruta(), pendientes[k].second.valores);
+            hechas++;
+        }
+    };
+    vector<thread> trabajadores;
+    for (size_t h = 0; h < hilos; ++h) trabajadores.emplace_back(trabajar);
+    while (hechas < pendientes.size()) {
+        cout << "\rAnalizadas " << hechas << "/" << pendientes.size() << flush;
+        this_thread::sleep_for(chrono::milliseconds(200));
+    }
+    for (thread& t : trabajadores) t.join();
+    if (!pendientes.empty()) cout << "\rAnalizadas " << hechas << "/" << pendientes.size() << endl;
+    double segundos = chrono::duration<double>(chrono::steady_clock::now() - inicio).count();
+
+    size_t fallidas = 0;
+    for (size_t k = 0; k < pendientes.size(); ++k) {
+        if (correctas[k]) registros.push_back(pendientes[k].second);
+        else fallidas++;
+    }
+    if (!IndiceSimilitud::guardarRegistros(rutaIndice, registros)) {
+        cerr << "No se pudo escribir " << rutaIndice << endl;
+        return 1;
+    }
+    cout << registros.size() << " canciones en el índice";
+    if (fallidas) cout << ", " << fallidas << " no se pudieron decodificar";
+    if (inexistentes) cout << ", " << inexistentes << " archivos no encontrados";
+    cout << endl;
+    if (!pendientes.empty()) {
+        cout << fixed << setprecision(1) << pendientes.size() / max(segundos, 1e-9) << " canciones/s" << endl;
+        cout.unsetf(ios::fixed);
+    }
+    return fallidas ? 1 : 0;
+}
+
+// Tiempo de una búsqueda de vecinos sobre una biblioteca sintética: pistas
+// agrupadas alrededor de estilos al azar, consultas desde pistas existentes
+int medirSimilitud(size_t n) {
+    mt19937 g(1);
+    normal_distribution<float> dist(0.0f, 1.0f);
+    const size_t estilos = 1000;
+    vector<float> centrosEstilo(estilos * NUM_CARACTERISTICAS);
+    for (float& v : centrosEstilo) v = dist(g);
+    vector<RegistroCaracteristicas> registros(n);
+    for (size_t i = 0; i < n; ++i) {
+        registros[i].pista = ((uint64_t)g() << 32) | g();
+        const float* e = &centrosEstilo[(g() % estilos) * NUM_CARACTERISTICAS];
+        for (int d = 0; d < NUM_CARACTERISTICAS; ++d) registros[i].valores[d] = e[d] + 0.5f * dist(g);
+    }
+    auto inicio = chrono::steady_clock::now();
+    IndiceSimilitud indice;
+    indice.construir(registros);
+    double msConstruir = chrono::duration<double, milli>(chrono::steady_clock::now() - inicio).count();
+
+    const int consultas = 200;
+    const size_t k = AUTOCOLA_CANCIONES;
+    unordered_set<uint64_t> excluir;
+    for (int i = 0; i < 100; ++i) excluir.insert(registros[g() % n].pista);
+    vector<double> tiempos[2];
+    size_t aciertos = 0;
+    for (int c = 0; c < consultas; ++c) {
+        vector<uint64_t> recientes = {registros[g() % n].pista};
+        vector<uint64_t> res[2];
+        for (int modo = 0; modo < 2; ++modo) {
+            auto t0 = chrono::steady_clock::now();
+            res[modo] = indice.vecinos(recientes, excluir, k, modo == 0 ? 0 : IVF_SONDEOS);
+            tiempos[modo].push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - t0).count());
+        }
+        for (uint64_t id : res[1]) aciertos += count(res[0].begin(), res[0].end(), id);
+    }
+
+    cout << "Búsqueda de " << k << " vecinos entre " << n << " canciones, " << consultas << " consultas" << endl;
+    cout << fixed << setprecision(0) << "Índice armado en " << msConstruir << " ms, "
+         << indice.listas() << " listas" << endl;
+    for (int modo = 0; modo < 2; ++modo) {
+        if (modo == 1 && indice.listas() == 0) break;
+        vector<double>& t = tiempos[modo];
+        sort(t.begin(), t.end());
+        double suma = 0;
+        for (double v : t) suma += v;
+        cout << (modo == 0 ? "exhaustiva: " : "por listas: ") << setprecision(1)
+             << "promedio " << suma / consultas << " µs, mediana " << t[consultas / 2]
+             << " µs, p99 " << t[consultas * 99 / 100] << " µs" << endl;
+    }
+    if (indice.listas() > 0) {
+        cout << "Coincidencia con la exhaustiva: " << setprecision(1)
+             << 100.0 * aciertos / (k * consultas) << " %" << endl;
+    }
+    cout.unsetf(ios::fixed);
+    return 0;
+}
+
+// --- Modo por línea de órdenes ---
+//
+// simpleplayer <orden> [argumentos] [--playlist ruta]
+// Cada orden carga solo los datos que necesita; "batch" lee órdenes de stdin.
+
+void mostrarAyuda() {
+    cout << "Uso: simpleplayer [orden] [argumentos] [--playlist ruta]\n"
+         << "Sin orden se abre el menú interactivo.\n\n"
+         << "  list                 Lista la biblioteca (o la playlist con --playlist)\n"
+         << "  search <texto>       Busca en la biblioteca por artista o título\n"
+         << "  add <n>              Agrega la canción n de la biblioteca a la playlist\n"
+         << "  remove <n>           Elimina la canción n de la playlist\n"
+         << "  save [ruta]          Guarda la playlist (en otra ruta si se indica)\n"
+         << "  play                 Reproduce la playlist\n"
+         << "  stats                Muestra las estadísticas de reproducción\n"
+         << "  batch                Lee órdenes de stdin, una por línea\n"
+         << "  --render <playlist> <salida.wav|.flac>\n"
+         << "                       Exporta la playlist a un solo archivo de audio\n"
+         << "  --verify [reporte.json] [--jobs N]\n"
+         << "                       Decodifica toda la biblioteca en busca de archivos dañados\n"
+         << "  --analyze [--jobs N] Analiza la biblioteca para la cola automática\n"
+         << "  --bench-similares [N]\n"
+         << "                       Mide la búsqueda de canciones parecidas entre N canciones\n"
+         << "  --bench-eq           Mide el costo por banda del ecualizador\n"
+         << "  --estres [hilos] [órdenes]\n"
+         << "                       Prueba el controlador con órdenes concurrentes\n"
+         << "  help                 Muestra esta ayuda\n";
+}
+
+// Separa una línea en palabras; las comillas dobles agrupan
+vector<string> separarPalabras(const string& linea) {
+    vector<string> palabras;
+    string actual;
+    bool entreComillas = false, hayPalabra = false;
+    for (char c : linea) {
+        if (c == '"') {
+            entreComillas = !entreComillas;
+            hayPalabra = true;
+        } else if (isspace((unsigned char)c) && !entreComillas) {
+            if (hayPalabra) palabras.push_back(actual);
+            actual.clear();
+            hayPalabra = false;
+        } else {
+            actual += c;
+            hayPalabra = true;
+        }
+    }
+    if (hayPalabra) palabras.push_back(actual);
+    return palabras;
+}
+
+void imprimirCancion(size_t n, const Cancion& c) {
+    cout << n << ". " << c.titulo << " - " << c.artista << '\n';
+}
+
+// Nombre de la orden, saltando opciones como --playlist igual que ejecutarOrden
+string nombreOrden(const vector<string>& args) {
+    for (size_t i = 0; i < args.size(); ) {
+        if (args[i] == "--playlist" && i + 1 < args.size()) i += 2;
+        else return args[i];
+    }
+    return "";
+}
+
+int ejecutarOrden(Sesion& sesion, vector<string> args, bool enLote) {
+    bool conPlaylist = false;
+    for (size_t i = 0; i < args.size(); ) {
+        if (args[i] == "--playlist" && i + 1 < args.size()) {
+            sesion.usarPlaylist(args[i + 1]);
+            conPlaylist = true;
+            args.erase(args.begin() + i, args.begin() + i + 2);
+        } else {
+            ++i;
+        }
+    }
+    if (args.empty()) return 0;
+    const string& orden = args[0];
+
+    if (orden == "list") {
+        if (conPlaylist) {
+            sesion.playlist().mostrarPlaylist();
+        } else if (!recorrerCanciones(sesion.rutaCanciones, [](size_t i, Cancion& c) {
+                       imprimirCancion(i + 1, c);
+                       return cout.good(); // Parar si se cerró la salida (p. ej. con head)
+                   })) {
+            cerr << "No se pudo abrir el archivo de canciones." << endl;
+            return 1;
+        }
+    } else if (orden == "search") {
+        string texto;
+        for (size_t i = 1; i < args.size(); ++i) texto += (i > 1 ? " " : "") + args[i];
+        texto = minusculas(texto);
+        recorrerCanciones(sesion.rutaCanciones, [&](size_t i, Cancion& c) {
+            if (minusculas(c.artista).find(texto) != string::npos || minusculas(c.titulo).find(texto) != string::npos) {
+                imprimirCancion(i + 1, c);
+            }
+            return cout.good();
+        });
+    } else if (orden == "add" || orden == "remove") {
+        long num = args.size() > 1 ? atol(args[1].c_str()) : 0;
+        Playlist& pl = sesion.playlist();
+        if (orden == "add") {
+            Cancion c;
+            if (!sesion.cancionEn(num, c)) {
+                cerr << "Número inválido." << endl;
+                return 1;
+            }
+            pl.agregarCancion(c);
+            cout << "Agregada: " << c.titulo << '\n';
+        } else {
+            if (num < 1 || num > pl.contar()) {
+                cerr << "Número inválido." << endl;
+                return 1;
+            }
+            pl.eliminarPorIndice(num);
+            cout << "Eliminada: " << num << '\n';
+        }
+        sesion.modificada = true;
+        if (!enLote) sesion.guardarPlaylist();
+    } else if (orden == "save") {
+        if (args.size() > 1) {
+            sesion.playlist().guardar(args[1]);
+            cout << "Playlist guardada en " << args[1] << '\n';
+        } else {
+            sesion.guardarPlaylist();
+            cout << "Playlist guardada en " << sesion.rutaPlaylist << '\n';
+        }
+    } else if (orden == "play") {
+        if (enLote) {
+            cerr << "play no está disponible en modo batch." << endl;
+            return 1;
+        }
+        reproducirPlaylist(sesion);
+    } else if (orden == "stats") {
+        mostrarEstadisticas(sesion.historial(), sesion.biblioteca());
+    } else if (orden == "--render") {
+        if (args.size() < 3) {
+            mostrarAyuda();
+            return 2;
+        }
+        return renderizarPlaylist(args[1], args[2]);
+    } else if (orden == "--verify") {
+        string rutaDir = obtenerRutaEjecutable();
+        string reporte = rutaDir + "/verificacion.json";
+        size_t hilos = max(1u, thread::hardware_concurrency());
+        for (size_t i = 1; i < args.size(); ++i) {
+            if (args[i] == "--jobs" && i + 1 < args.size()) hilos = max(1L, atol(args[++i].c_str()));
+            else reporte = args[i];
+        }
+        return verificarBiblioteca(sesion, reporte, rutaDir + "/verificacion.cache.json", hilos);
+    } else if (orden == "--analyze") {
+        size_t hilos = max(1u, thread::hardware_concurrency());
+        if (args.size() >= 3 && args[1] == "--jobs") hilos = max(1L, atol(args[2].c_str()));
+        return analizarBiblioteca(sesion, obtenerRutaEjecutable() + "/caracteristicas.bin", hilos);
+    } else if (orden == "--bench-similares") {
+        return medirSimilitud(args.size() >= 2 ? max(1L, atol(args[1].c_str())) : 500000);
+    } else if (orden == "--estres") {
+        size_t hilos = args.size() >= 2 ? max(1L, atol(args[1].c_str())) : 8;
+        size_t ordenes = args.size() >= 3 ? max(1L, atol(args[2].c_str())) : 10000;
+        return probarControlador(hilos, ordenes);
+    } else if (orden == "--bench-eq") {
+        return medirEcualizador();
+    } else if (orden == "help" || orden == "--help" || orden == "-h") {
+        mostrarAyuda();
+    } else {
+        cerr << "Orden desconocida: " << orden << endl;
+        mostrarAyuda();
+        return 2;
+    }
+    return 0;
+}
+
+// Ejecuta órdenes leídas de stdin; los cambios se guardan al terminar
+int ejecutarLote(Sesion& sesion, vector<string> args) {
+    int resultado = 0;
+    sesion.enLote = true;
+    // Tras "batch" solo se admiten opciones; las órdenes llegan por stdin
+    for (size_t i = 1; i < args.size(); i += 2) {
+        if (args[i] != "--playlist" || i + 1 >= args.size()) {
+            cerr << "batch solo admite --playlist ruta; las órdenes se leen de la entrada estándar." << endl;
+            return 2;
+        }
+        sesion.usarPlaylist(args[i + 1]);
+    }
+    string linea;
+    while (getline(cin, linea)) {
+        vector<string> palabras = separarPalabras(linea);
+        if (palabras.empty() || palabras[0][0] == '#') continue;
+        if (ejecutarOrden(sesion, palabras, true) != 0) resultado = 1;
+    }
+    if (sesion.modificada) sesion.guardarPlaylist();
+    cout << flush;
+    return resultado;
+}
+
+int main(int argc, char* argv[]) {
+    // Si ffplay se cierra, la escritura en su tubería debe fallar, no matarnos
+    signal(SIGPIPE, SIG_IGN);
     
     string rutaEjecutable = obtenerRutaEjecutable();
-    string rutaCanciones = rutaEjecutable + "/canciones.json";
-    string rutaPlaylist = rutaEjecutable + "/playlist.json";
+    Sesion sesion(rutaEjecutable + "/canciones.json",
+                  rutaEjecutable + "/playlist.json",
+                  rutaEjecutable + "/historial.bin");
 
-    vector<Cancion> cancionesDisponibles = cargarCancionesDisponibles(rutaCanciones);
-    Playlist miPlaylist;
-    miPlaylist.cargar(rutaPlaylist);
+    if (argc > 1) {
+        vector<string> args(argv + 1, argv + argc);
+        // El reproductor lee teclas con getchar(): solo sin él se desacopla iostream de stdio
+        if (nombreOrden(args) != "play") ios::sync_with_stdio(false);
+        if (args[0] == "batch") return ejecutarLote(sesion, args);
+        int resultado = ejecutarOrden(sesion, args, false);
+        cout << flush;
+        return resultado;
+    }
+
+    unique_ptr<ExploradorBiblioteca> explorador; // Conserva los órdenes ya calculados
 
     int opcion;
     do {
@@ -839,12 +4300,8 @@ int main() {
         cin.ignore();
         switch (opcion) {
             case 1:
-                limpiarPantalla();
-                cout << "Canciones disponibles:" << endl;
-                for (size_t i = 0; i < cancionesDisponibles.size(); ++i) {
-                    cout << i+1 << ". " << cancionesDisponibles[i].titulo << " - " << cancionesDisponibles[i].artista << endl;
-                }
-                pausa();
+                if (!explorador) explorador.reset(new ExploradorBiblioteca(sesion.biblioteca()));
+                explorador->explorar();
                 break;
             case 2: {
                 limpiarPantalla();
@@ -852,9 +4309,10 @@ int main() {
                 int num;
                 cin >> num;
                 cin.ignore();
-                if (num >= 1 && num <= (int)cancionesDisponibles.size()) {
-                    miPlaylist.agregarCancion(cancionesDisponibles[num-1]);
-                    cout << "Agregada: " << cancionesDisponibles[num-1].titulo << endl;
+                Cancion c;
+                if (num >= 1 && sesion.cancionEn(num, c)) {
+                    sesion.playlist().agregarCancion(c);
+                    cout << "Agregada: " << c.titulo << endl;
                 } else {
                     cout << "Número inválido." << endl;
                 }
@@ -864,36 +4322,44 @@ int main() {
             case 3:
                 limpiarPantalla();
                 cout << "Tu playlist:" << endl;
-                miPlaylist.mostrarPlaylist();
+                sesion.playlist().mostrarPlaylist();
                 pausa();
                 break;
             case 4:
                 limpiarPantalla();
-                cout << "Duración total: " << (int)miPlaylist.duracionTotal() << " minutos" << endl;
+                cout << "Duración total: " << (int)sesion.playlist().duracionTotal() << " minutos" << endl;
                 pausa();
                 break;
             case 5:
-                modoReproductor(miPlaylist);
+                reproducirPlaylist(sesion);
                 break;
             case 6:
-                miPlaylist.guardar(rutaPlaylist);
-                cout << "Playlist guardada en " << rutaPlaylist << endl;
+                sesion.guardarPlaylist();
+                cout << "Playlist guardada en " << sesion.rutaPlaylist << endl;
                 pausa();
                 break;
             case 7:
                 limpiarPantalla();
                 cout << "Tu playlist:" << endl;
-                miPlaylist.mostrarPlaylist();
+                sesion.playlist().mostrarPlaylist();
                 cout << "¿Qué canción deseas eliminar? Ingresa el número: ";
                 int num;
                 cin >> num;
                 cin.ignore();
-                miPlaylist.eliminarPorIndice(num);
+                sesion.playlist().eliminarPorIndice(num);
                 cout << "Eliminada (si existía)." << endl;
                 pausa();
                 break;
+            case 9:
+                limpiarPantalla();
+                mostrarEstadisticas(sesion.historial(), sesion.biblioteca());
+                pausa();
+                break;
+            case 10:
+                menuEcualizador(sesion);
+                break;
             case 8:
-                miPlaylist.guardar(rutaPlaylist);
+                sesion.guardarSiCargada();
                 cout << "¡Hasta luego!" << endl;
                 break;
             default: